@@ -24,11 +24,20 @@
 #include <linux/random.h>
 #endif
 
+#include <linux/io.h>
+#include <linux/ctype.h>
+#include <linux/delay.h>
+#include <linux/dmi.h>
+#include <linux/firmware.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
 #include "fthd_drv.h"
 #include "fthd_hw.h"
 #include "fthd_ddr.h"
+#include "fthd_isp.h"
 
-int fthd_ddr_verify_mem(struct fthd_private *dev_priv, u32 base, int count)
+static int fthd_ddr_verify_mem_words(struct fthd_private *dev_priv, int count)
 {
 	u32 i, val, val_read;
 	int failed_bits = 0;
@@ -53,6 +62,45 @@ int fthd_ddr_verify_mem(struct fthd_private *dev_priv, u32 base, int count)
 	return ((failed_bits & 0xffff) | ((failed_bits >> 16) & 0xffff));
 }
 
+/*
+ * Write the same prandom pattern as above in one burst, read it back in one
+ * burst and compare 64 bits at a time. The returned value still has a bit set
+ * for every data line that failed in either half of a 32-bit word.
+ */
+int fthd_ddr_verify_mem(struct fthd_private *dev_priv, u32 base, int count)
+{
+	struct rnd_state state;
+	u64 *pattern, *readback, failed = 0;
+	u32 failed_bits, len, i;
+
+	len = count * 4;
+	if (count <= 0 || MEM_VERIFY_BASE + len > dev_priv->s2_mem_len)
+		return fthd_ddr_verify_mem_words(dev_priv, count);
+
+	/* One allocation for both, rounded up to whole u64s */
+	pattern = kvmalloc_array(2, ALIGN(len, 8), GFP_KERNEL);
+	if (!pattern)
+		return fthd_ddr_verify_mem_words(dev_priv, count);
+	readback = (void *)pattern + ALIGN(len, 8);
+
+	prandom_seed_state(&state, 0x12345678);
+	for (i = 0; i < count; i++)
+		((u32 *)pattern)[i] = prandom_u32_state(&state);
+
+	FTHD_S2_MEMCPY_TOIO(MEM_VERIFY_BASE, pattern, len);
+	FTHD_S2_MEMCPY_FROMIO(readback, MEM_VERIFY_BASE, len);
+
+	for (i = 0; i < len / 8; i++)
+		failed |= pattern[i] ^ readback[i];
+	if (count & 1)
+		failed |= ((u32 *)pattern)[count - 1] ^ ((u32 *)readback)[count - 1];
+
+	kvfree(pattern);
+
+	failed_bits = (u32)failed | (u32)(failed >> 32);
+	return ((failed_bits & 0xffff) | ((failed_bits >> 16) & 0xffff));
+}
+
 static int fthd_ddr_calibrate_rd_data_dly_fifo(struct fthd_private *dev_priv)
 {
 	u32 fifo_status[2];
@@ -339,14 +387,27 @@ static int fthd_ddr_calibrate_re_byte_fifo(struct fthd_private *dev_priv)
 	return 0;
 }
 
-/* Set default/generic read data strobe */
+/*
+ * Set default/generic read data strobe. This sweep has never been seen to
+ * succeed and what a pass should look like is still unknown, so a failure
+ * restores the strobe and RDEN registers it moved and is reported as such.
+ */
+static const u32 fthd_ddr_rd_dqs_regs[] = {
+	S2_DDR40_2A08, S2_DDR40_2A0C, S2_DDR40_2AA8, S2_DDR40_2AAC,
+	S2_DDR40_RDEN_BYTE0, S2_DDR40_RDEN_BYTE0 + S2_DDR40_BYTE_LANE_SIZE,
+};
+
 static int fthd_ddr_generic_shmoo_rd_dqs(struct fthd_private *dev_priv,
 					 u32 *fail_bits)
 {
 	u32 retries, setting, tmp, offset;
 	u32 bytes[S2_DDR40_NUM_BYTE_LANES];
+	u32 saved[ARRAY_SIZE(fthd_ddr_rd_dqs_regs)];
 	int i, j, ret, fail;
 
+	for (i = 0; i < ARRAY_SIZE(fthd_ddr_rd_dqs_regs); i++)
+		saved[i] = FTHD_S2_REG_READ(fthd_ddr_rd_dqs_regs[i]);
+
 	/* Save the current byte lanes */
 	for (i = 0; i < S2_DDR40_NUM_BYTE_LANES; i++) {
 		tmp = FTHD_S2_REG_READ(S2_DDR40_RDEN_BYTE0 +
@@ -407,35 +468,39 @@ static int fthd_ddr_generic_shmoo_rd_dqs(struct fthd_private *dev_priv,
 		}
 	}
 
-	if (retries == 0) {
+	/* The loop only ends on a failure or with the retries used up */
+	if (!fail) {
 		dev_err(&dev_priv->pdev->dev, "Generic shmoo RD DQS timeout\n");
+		ret = -ETIMEDOUT;
+	} else {
+		dev_info(&dev_priv->pdev->dev, "Generic RD DQS failed\n");
 		ret = -EIO;
 	}
 
-	if (fail)
-		dev_info(&dev_priv->pdev->dev, "Generic RD DQS failed\n");
-	else
-		dev_info(&dev_priv->pdev->dev, "Generic RD DQS succeeded\n");
+	for (i = 0; i < ARRAY_SIZE(fthd_ddr_rd_dqs_regs); i++)
+		FTHD_S2_REG_WRITE(saved[i], fthd_ddr_rd_dqs_regs[i]);
 
-	/* It always fails, so just pass success */
-	return 0;
+	return ret;
 }
 
-static int fthd_ddr_calibrate_rd_dqs(struct fthd_private *dev_priv,
-				     u32 *fails, u32 *settings)
+/*
+ * Find the middle of the passing window of each of the lowest nbits bits.
+ * The pass/fail map of each bit goes to the debug log.
+ */
+static int fthd_ddr_shmoo_center(struct fthd_private *dev_priv,
+				 u32 *fails, u32 *settings, int nbits)
 {
 	s32 pass_len[16];
 	u32 pass_start[16]; // u32 var_b0[16];
 	u32 pass_end[16]; // u32 var_f0[16];
-	int fail_sum, i, j, bit;
+	char eye[65];	/* one char per setting, the pass start twice */
+	int fail_sum, i, j, bit, n;
 	s32 setting;
-	printk(KERN_CONT "\n");
 
-	for (bit = 0; bit < 16; bit++) {
+	for (bit = 0; bit < nbits; bit++) {
 		pass_start[bit] = 64;
 		pass_end[bit] = 64;
-
-		printk(KERN_CONT "%.2d: ", bit);
+		n = 0;
 
 		/* Start looking for start of pass */
 		for (i = 0; i < 63; i++) {
@@ -446,9 +511,9 @@ static int fthd_ddr_calibrate_rd_dqs(struct fthd_private *dev_priv,
 				fail_sum += fails[i + j] & (1 << bit);
 
 			if (fail_sum) {
-				printk(KERN_CONT ".");
+				eye[n++] = '.';
 			} else {
-				printk(KERN_CONT "O");
+				eye[n++] = 'O';
 
 				pass_start[bit] = i;
 				break;
@@ -461,11 +526,12 @@ static int fthd_ddr_calibrate_rd_dqs(struct fthd_private *dev_priv,
 				if (pass_end[bit] == 64)
 					pass_end[bit] = i;
 
-				printk(KERN_CONT ".");
+				eye[n++] = '.';
 			} else {
-				printk(KERN_CONT "O");
+				eye[n++] = 'O';
 			}
 		}
+		eye[n] = '\0';
 
 		/* Calculate pass length */
 		pass_len[bit] = pass_end[bit] - pass_start[bit];
@@ -478,8 +544,8 @@ static int fthd_ddr_calibrate_rd_dqs(struct fthd_private *dev_priv,
 			setting = 63;
 		settings[bit] = setting;
 
-		printk(KERN_CONT " : start=%d end=%d len=%d new=%d\n", pass_start[bit],
-		       pass_end[bit], pass_len[bit], settings[bit]);
+		pr_debug("%.2d: %s : start=%d end=%d len=%d new=%d\n", bit, eye,
+			 pass_start[bit], pass_end[bit], pass_len[bit], settings[bit]);
 	}
 
 	// Some global stuff that I need to figure out
@@ -521,7 +587,7 @@ static int fthd_ddr_wr_dqs_setting(struct fthd_private *dev_priv, int set_bits,
 		inc = 2;
 	}
 
-	fthd_ddr_calibrate_rd_dqs(dev_priv, fail_bits, settings);
+	fthd_ddr_shmoo_center(dev_priv, fail_bits, settings, 16);
 
 	offset = 0;
 
@@ -553,11 +619,6 @@ static int fthd_ddr_wr_dqs_setting(struct fthd_private *dev_priv, int set_bits,
 	return 0;
 }
 
-static int fthd_ddr_calibrate_create_result(struct fthd_private *dev_priv)
-{
-	return 0;
-}
-
 static int fthd_ddr_generic_shmoo_calibrate_rd_dqs(
 						struct fthd_private *dev_priv)
 {
@@ -565,9 +626,16 @@ static int fthd_ddr_generic_shmoo_calibrate_rd_dqs(
 	u32 fails[64]; /* Number of fails on a setting */
 	int ret;
 
+	/*
+	 * The per-bit sweeps below don't depend on the generic strobe, they
+	 * start over from the restored one. Whether the result is usable is
+	 * decided by the final memory verification.
+	 */
 	ret = fthd_ddr_generic_shmoo_rd_dqs(dev_priv, fails);
 	if (ret)
-		return ret;
+		dev_warn(&dev_priv->pdev->dev,
+			 "Generic RD DQS failed (%d), continuing with per-bit RD DQS\n",
+			 ret);
 
 	ret = fthd_ddr_wr_dqs_setting(dev_priv, 3, fails, settings);
 	if (ret)
@@ -578,21 +646,39 @@ static int fthd_ddr_generic_shmoo_calibrate_rd_dqs(
 		return ret;
 
 
-	ret = fthd_ddr_wr_dqs_setting(dev_priv, 2, fails, settings);
-	if (ret)
-		return ret;
-
-	/* NOP for now */
-	ret = fthd_ddr_calibrate_create_result(dev_priv);
-	if (ret)
-		return ret;
-
-	return 0;
+	/*
+	 * The per-bit centers are programmed as they are found. A final
+	 * "create result" step of the vendor shmoo is still unknown and
+	 * not done here.
+	 */
+	return fthd_ddr_wr_dqs_setting(dev_priv, 2, fails, settings);
 }
 
 static int fthd_ddr_calibrate_wr_dq(struct fthd_private *dev_priv, u32 *fails,
 				    u32 *settings)
 {
+	u32 offset;
+	int bl, bit;
+
+	fthd_ddr_shmoo_center(dev_priv, fails, settings, 16);
+
+	for (bl = 0; bl < S2_DDR40_NUM_BYTE_LANES; bl++) {
+		offset = S2_DDR40_2A10 + (bl * S2_DDR40_BYTE_LANE_SIZE);
+
+		for (bit = 0; bit < 8; bit++) {
+			if (settings[bl * 8 + bit] == 0 ||
+			    settings[bl * 8 + bit] >= 63) {
+				dev_err(&dev_priv->pdev->dev,
+					"Bad WR DQ VDL. Bit %d = 0x%x\n",
+					bl * 8 + bit, settings[bl * 8 + bit]);
+				return -EINVAL;
+			}
+
+			FTHD_S2_REG_WRITE((settings[bl * 8 + bit] & 0x3f) |
+					  0x30000, offset + (bit * 4));
+		}
+	}
+
 	return 0;
 }
 
@@ -618,33 +704,131 @@ static int fthd_ddr_generic_shmoo_calibrate_wr_dq(struct fthd_private *dev_priv)
 
 	fails[63] = 0xffff; /* Last setting is always a fail */
 
-	fthd_ddr_calibrate_wr_dq(dev_priv, fails, settings);
+	ret = fthd_ddr_calibrate_wr_dq(dev_priv, fails, settings);
+	if (!ret)
+		dev_info(&dev_priv->pdev->dev, "WR DQ shmoo succeeded\n");
 
 	return ret;
 }
 
+/*
+ * The data mask has no readback of its own. A bad DM delay shows up as
+ * corrupted writes, so a byte lane fails if any of its data bits do.
+ */
 static int fthd_ddr_generic_shmoo_calibrate_wr_dm(struct fthd_private *dev_priv)
 {
+	u32 fails[64];
+	u32 settings[S2_DDR40_NUM_BYTE_LANES];
+	u32 saved[S2_DDR40_NUM_BYTE_LANES];
+	u32 setting, offset, tmp;
+	int bl;
+
+	for (bl = 0; bl < S2_DDR40_NUM_BYTE_LANES; bl++)
+		saved[bl] = FTHD_S2_REG_READ(S2_DDR40_2A30 +
+					     (bl * S2_DDR40_BYTE_LANE_SIZE));
+
+	for (setting = 0; setting < 64; setting++) {
+		for (bl = 0; bl < S2_DDR40_NUM_BYTE_LANES; bl++) {
+			offset = S2_DDR40_2A30 + (bl * S2_DDR40_BYTE_LANE_SIZE);
+			FTHD_S2_REG_WRITE(setting | 0x30000, offset);
+		}
+
+		tmp = fthd_ddr_verify_mem(dev_priv, 0, MEM_VERIFY_NUM);
+
+		fails[setting] = 0;
+		for (bl = 0; bl < S2_DDR40_NUM_BYTE_LANES; bl++) {
+			if (tmp & (0xff << (bl * 8)))
+				fails[setting] |= 1 << bl;
+		}
+	}
+
+	fails[63] = (1 << S2_DDR40_NUM_BYTE_LANES) - 1;
+
+	fthd_ddr_shmoo_center(dev_priv, fails, settings,
+			      S2_DDR40_NUM_BYTE_LANES);
+
+	for (bl = 0; bl < S2_DDR40_NUM_BYTE_LANES; bl++) {
+		if (settings[bl] == 0 || settings[bl] >= 63) {
+			dev_err(&dev_priv->pdev->dev,
+				"Bad WR DM VDL. Byte %d = 0x%x\n",
+				bl, settings[bl]);
+
+			for (bl = 0; bl < S2_DDR40_NUM_BYTE_LANES; bl++)
+				FTHD_S2_REG_WRITE(saved[bl], S2_DDR40_2A30 +
+						  (bl * S2_DDR40_BYTE_LANE_SIZE));
+			return -EINVAL;
+		}
+	}
+
+	for (bl = 0; bl < S2_DDR40_NUM_BYTE_LANES; bl++) {
+		offset = S2_DDR40_2A30 + (bl * S2_DDR40_BYTE_LANE_SIZE);
+		FTHD_S2_REG_WRITE((settings[bl] & 0x3f) | 0x30000, offset);
+	}
+
+	dev_info(&dev_priv->pdev->dev, "WR DM shmoo succeeded: b0 = 0x%x, b1 = 0x%x\n",
+		 settings[0], settings[1]);
+
 	return 0;
 }
 
+/*
+ * Address and command lines go through the bit VDL override of the PHY
+ * control block. A wrong delay corrupts whole words, so there is only one
+ * fail bit per setting.
+ */
 static int fthd_ddr_generic_shmoo_calibrate_addr(struct fthd_private *dev_priv)
 {
+	u32 fails[64];
+	u32 settings[1];
+	u32 setting, saved;
+
+	saved = FTHD_S2_REG_READ(S2_DDR40_PHY_VDL_OVR_FINE);
+
+	for (setting = 0; setting < 64; setting++) {
+		FTHD_S2_REG_WRITE(setting | 0x30000, S2_DDR40_PHY_VDL_OVR_FINE);
+
+		fails[setting] = fthd_ddr_verify_mem(dev_priv, 0, MEM_VERIFY_NUM) ?
+				 1 : 0;
+	}
+
+	fails[63] = 1;
+
+	fthd_ddr_shmoo_center(dev_priv, fails, settings, 1);
+
+	if (settings[0] == 0 || settings[0] >= 63) {
+		dev_err(&dev_priv->pdev->dev, "Bad ADDR VDL = 0x%x\n",
+			settings[0]);
+		FTHD_S2_REG_WRITE(saved, S2_DDR40_PHY_VDL_OVR_FINE);
+		return -EINVAL;
+	}
+
+	FTHD_S2_REG_WRITE((settings[0] & 0x3f) | 0x30000,
+			  S2_DDR40_PHY_VDL_OVR_FINE);
+
+	dev_info(&dev_priv->pdev->dev, "ADDR shmoo succeeded: 0x%x\n",
+		 settings[0]);
+
 	return 0;
 }
 
 int fthd_ddr_calibrate(struct fthd_private *dev_priv)
 {
 	u32 reg;
-	int ret;
+	int retries, ret;
 
 	FTHD_S2_REG_WRITE(0, S2_DDR40_PHY_VDL_CTL);
 	FTHD_S2_REG_WRITE(0x200, S2_DDR40_PHY_VDL_CTL);
 
-	while (1) {
+	for (retries = 0; retries < 1000; retries++) {
 		reg = FTHD_S2_REG_READ(S2_DDR40_PHY_VDL_STATUS);
 		if (reg & 0x1)
 			break;
+		udelay(10);
+	}
+
+	if (!(reg & 0x1)) {
+		dev_err(&dev_priv->pdev->dev, "VDL calibration timeout\n");
+		return -ETIMEDOUT;
 	}
 
 	ret = fthd_ddr_calibrate_rd_data_dly_fifo(dev_priv);
@@ -673,3 +857,320 @@ int fthd_ddr_calibrate(struct fthd_private *dev_priv)
 
 	return 0;
 }
+
+/* Build the firmware name of the PHY cache for this machine */
+static void fthd_ddr_cache_name(char *buf, size_t len)
+{
+	const char *board = dmi_get_system_info(DMI_BOARD_NAME);
+	char *p;
+
+	snprintf(buf, len, "facetimehd/ddr_phy-%s.bin", board ? board : "unknown");
+
+	for (p = buf + sizeof("facetimehd/ddr_phy-") - 1; *p; p++) {
+		if (!isalnum(*p) && *p != '-' && *p != '_' && *p != '.')
+			*p = '_';
+	}
+}
+
+/* Only write back shmoo results, leave the PLLs alone */
+static void fthd_ddr_phy_write_lanes(struct fthd_private *dev_priv,
+				     const u32 *regs)
+{
+	u32 offset;
+	int i;
+
+	for (i = 0; i < DDR_PHY_NUM_REG; i++) {
+		offset = fthd_ddr_phy_reg_map[i];
+		if (offset < DDR_PHY_LANE_REG_START &&
+		    offset != DDR_PHY_ADDR_VDL_REG)
+			continue;
+
+		FTHD_S2_REG_WRITE(regs[i], DDR_PHY_REG_BASE + offset);
+	}
+}
+
+static int fthd_ddr_cache_load(struct fthd_private *dev_priv)
+{
+	const struct fthd_ddr_cache *cache;
+	const struct firmware *fw;
+	char name[64];
+	int ret;
+
+	fthd_ddr_cache_name(name, sizeof(name));
+
+	ret = request_firmware_direct(&fw, name, &dev_priv->pdev->dev);
+	if (ret)
+		return ret;
+
+	cache = (const struct fthd_ddr_cache *)fw->data;
+	if (fw->size != sizeof(*cache) ||
+	    cache->magic != FTHD_DDR_CACHE_MAGIC ||
+	    cache->version != FTHD_DDR_CACHE_VERSION ||
+	    cache->num_regs != DDR_PHY_NUM_REG ||
+	    cache->ddr_model != dev_priv->ddr_model ||
+	    cache->ddr_speed != dev_priv->ddr_speed) {
+		dev_warn(&dev_priv->pdev->dev,
+			 "Ignoring incompatible DDR PHY cache %s\n", name);
+		release_firmware(fw);
+		return -EINVAL;
+	}
+
+	fthd_ddr_phy_write_lanes(dev_priv, cache->regs);
+	dev_priv->ddr_cache_sensor_id0 = cache->sensor_id0;
+	dev_priv->ddr_cache_sensor_id1 = cache->sensor_id1;
+
+	release_firmware(fw);
+	return 0;
+}
+
+void fthd_ddr_cache_fill(struct fthd_private *dev_priv,
+			 struct fthd_ddr_cache *cache)
+{
+	memset(cache, 0, sizeof(*cache));
+	cache->magic = FTHD_DDR_CACHE_MAGIC;
+	cache->version = FTHD_DDR_CACHE_VERSION;
+	cache->ddr_model = dev_priv->ddr_model;
+	cache->ddr_speed = dev_priv->ddr_speed;
+	cache->sensor_id0 = dev_priv->sensor_id0;
+	cache->sensor_id1 = dev_priv->sensor_id1;
+	cache->num_regs = DDR_PHY_NUM_REG;
+	memcpy(cache->regs, dev_priv->ddr_phy_regs, sizeof(cache->regs));
+}
+
+/*
+ * The sensor id is only known once the firmware runs, long after the DDR
+ * has been set up, so a cache recorded with another sensor can only be
+ * reported here.
+ */
+void fthd_ddr_cache_check(struct fthd_private *dev_priv)
+{
+	if (dev_priv->ddr_phy_source != FTHD_DDR_PHY_CACHE)
+		return;
+
+	if (dev_priv->ddr_cache_sensor_id0 != dev_priv->sensor_id0 ||
+	    dev_priv->ddr_cache_sensor_id1 != dev_priv->sensor_id1)
+		dev_warn(&dev_priv->pdev->dev,
+			 "DDR PHY cache was recorded with sensor %04x %04x, found %04x %04x\n",
+			 dev_priv->ddr_cache_sensor_id0,
+			 dev_priv->ddr_cache_sensor_id1,
+			 dev_priv->sensor_id0, dev_priv->sensor_id1);
+}
+
+/*
+ * Bring the DDR PHY into a working state. A cached shmoo result for this
+ * machine is tried first, then the power-on defaults and, if those fail
+ * verification and ddr_shmoo is set, a full shmoo. Whatever fails is rolled
+ * back so we never end up worse than the defaults.
+ */
+int fthd_ddr_phy_init(struct fthd_private *dev_priv)
+{
+	char name[64];
+	int ret;
+
+	dev_priv->ddr_phy_source = FTHD_DDR_PHY_DEFAULT;
+
+	/* Power-on defaults to roll back to */
+	fthd_ddr_phy_save_regs(dev_priv);
+
+	if (!fthd_ddr_cache_load(dev_priv)) {
+		ret = fthd_ddr_verify_mem(dev_priv, 0, MEM_VERIFY_NUM);
+		if (!ret) {
+			dev_info(&dev_priv->pdev->dev,
+				 "Using cached DDR PHY settings\n");
+			dev_priv->ddr_phy_source = FTHD_DDR_PHY_CACHE;
+			return 0;
+		}
+
+		dev_warn(&dev_priv->pdev->dev,
+			 "Cached DDR PHY settings failed verification (%d)\n",
+			 ret);
+		fthd_ddr_phy_write_lanes(dev_priv, dev_priv->ddr_phy_regs);
+	}
+
+	ret = fthd_ddr_verify_mem(dev_priv, 0, MEM_VERIFY_NUM);
+	if (!ret) {
+		dev_info(&dev_priv->pdev->dev,
+			 "Full memory verification succeeded! (%d)\n", ret);
+		return 0;
+	}
+
+	dev_err(&dev_priv->pdev->dev,
+		"Full memory verification failed! (%d)\n", ret);
+
+	/* Part of the shmoo programs registers that are not documented */
+	if (!dev_priv->ddr_shmoo) {
+		dev_info(&dev_priv->pdev->dev,
+			 "Keeping default PHY settings, load with ddr_shmoo=1 to calibrate\n");
+		return -EIO;
+	}
+
+	ret = fthd_ddr_calibrate(dev_priv);
+	if (!ret && fthd_ddr_verify_mem(dev_priv, 0, MEM_VERIFY_NUM))
+		ret = -EIO;
+
+	if (ret) {
+		dev_err(&dev_priv->pdev->dev,
+			"DDR shmoo failed (%d), keeping default PHY settings\n",
+			ret);
+		fthd_ddr_phy_write_lanes(dev_priv, dev_priv->ddr_phy_regs);
+		return ret;
+	}
+
+	dev_priv->ddr_phy_source = FTHD_DDR_PHY_SHMOO;
+
+	fthd_ddr_cache_name(name, sizeof(name));
+	dev_info(&dev_priv->pdev->dev,
+		 "DDR shmoo succeeded, save debugfs ddr_phy as %s to reuse it\n",
+		 name);
+
+	return 0;
+}
+
+static const u32 fthd_ddr_bench_xfers[FTHD_DDR_BENCH_XFERS] = {
+	4, 64, 512, 4096, 65536
+};
+
+/* Move size bytes in xfer sized chunks, 4 means plain 32-bit MMIO */
+static u64 fthd_ddr_bench_copy(void __iomem *mem, void *buf, u32 size,
+			       u32 xfer, int write)
+{
+	u32 *words = buf;
+	ktime_t start;
+	u32 off;
+
+	start = ktime_get();
+
+	if (xfer == 4) {
+		for (off = 0; off < size; off += 4) {
+			if (write)
+				iowrite32(words[off / 4], mem + off);
+			else
+				words[off / 4] = ioread32(mem + off);
+		}
+	} else {
+		for (off = 0; off < size; off += xfer) {
+			if (write)
+				memcpy_toio(mem + off, buf + off, xfer);
+			else
+				memcpy_fromio(buf + off, mem + off, xfer);
+		}
+	}
+
+	/* Posted writes only count once they have reached the device */
+	if (write)
+		ioread32(mem);
+
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+static void fthd_ddr_bench_latency(void __iomem *mem, u32 size, int map,
+				   struct fthd_ddr_bench_result *res)
+{
+	struct rnd_state state;
+	u64 rd_total = 0, wr_total = 0, ns;
+	ktime_t start;
+	u32 off;
+	int i;
+
+	res->rd_min_ns[map] = res->wr_min_ns[map] = U64_MAX;
+	prandom_seed_state(&state, 0x12345678);
+
+	for (i = 0; i < FTHD_DDR_BENCH_LAT_NUM; i++) {
+		off = (prandom_u32_state(&state) % size) & ~3;
+
+		start = ktime_get();
+		ioread32(mem + off);
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+		rd_total += ns;
+		res->rd_min_ns[map] = min(res->rd_min_ns[map], ns);
+		res->rd_max_ns[map] = max(res->rd_max_ns[map], ns);
+
+		start = ktime_get();
+		iowrite32(off, mem + off);
+		ioread32(mem + off);
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+		wr_total += ns;
+		res->wr_min_ns[map] = min(res->wr_min_ns[map], ns);
+		res->wr_max_ns[map] = max(res->wr_max_ns[map], ns);
+	}
+
+	res->rd_avg_ns[map] = div_u64(rd_total, FTHD_DDR_BENCH_LAT_NUM);
+	res->wr_avg_ns[map] = div_u64(wr_total, FTHD_DDR_BENCH_LAT_NUM);
+}
+
+/*
+ * Measure host to S2 memory bandwidth and latency through the existing
+ * uncached mapping and, where possible, a temporary write-combined one. The
+ * test region is taken from the ISP memory allocator so that nothing owned
+ * by the firmware gets overwritten.
+ *
+ * On x86 the whole BAR is already mapped UC- through s2_mem and PAT doesn't
+ * allow a WC alias of it: ioremap_wc() either inherits the UC- type or is
+ * refused with a conflict warning. Only the uncached mapping is measured
+ * there.
+ */
+int fthd_ddr_bench(struct fthd_private *dev_priv, u32 size,
+		   struct fthd_ddr_bench_result *res)
+{
+	struct isp_mem_obj *obj;
+	void __iomem *mem[FTHD_DDR_BENCH_MAPS];
+	struct rnd_state state;
+	u32 *buf;
+	int maps = 1, map, i, ret = 0;
+
+	memset(res, 0, sizeof(*res));
+
+	size = ALIGN(size, fthd_ddr_bench_xfers[FTHD_DDR_BENCH_XFERS - 1]);
+	if (!size || size > FTHD_DDR_BENCH_MAX)
+		return -EINVAL;
+
+	buf = vmalloc(size);
+	if (!buf)
+		return -ENOMEM;
+
+	obj = isp_mem_create(dev_priv, FTHD_MEM_BUFFER, size);
+	if (!obj) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	mem[0] = dev_priv->s2_mem + obj->offset;
+	mem[1] = NULL;
+#ifndef CONFIG_X86
+	mem[1] = ioremap_wc(obj->base.start, size);
+	if (mem[1])
+		maps = 2;
+	else
+		dev_info(&dev_priv->pdev->dev, "no write-combined mapping, measuring uncached only\n");
+#endif
+
+	prandom_seed_state(&state, 0x12345678);
+	for (i = 0; i < size / 4; i++)
+		buf[i] = prandom_u32_state(&state);
+
+	for (map = 0; map < maps; map++) {
+		for (i = 0; i < FTHD_DDR_BENCH_XFERS; i++) {
+			struct fthd_ddr_bench_xfer *bw = &res->bw[map][i];
+
+			bw->xfer = fthd_ddr_bench_xfers[i];
+			bw->write_ns = fthd_ddr_bench_copy(mem[map], buf, size,
+							   bw->xfer, 1);
+			bw->read_ns = fthd_ddr_bench_copy(mem[map], buf, size,
+							  bw->xfer, 0);
+			cond_resched();
+		}
+
+		fthd_ddr_bench_latency(mem[map], size, map, res);
+	}
+
+	res->size = size;
+	res->maps = maps;
+	res->valid = 1;
+
+	if (mem[1])
+		iounmap(mem[1]);
+	isp_mem_destroy(obj);
+out_free:
+	vfree(buf);
+	return ret;
+}
@@ -24,7 +24,69 @@
 #define MEM_VERIFY_NUM		128
 #define MEM_VERIFY_NUM_FULL	(1 * 1024 * 1024)
 
+/*
+ * Registers below this offset are PLL and control setup, not shmoo results,
+ * except for the address/command VDL override the shmoo also tunes
+ */
+#define DDR_PHY_LANE_REG_START	0x200
+#define DDR_PHY_ADDR_VDL_REG	(S2_DDR40_PHY_VDL_OVR_FINE - DDR_PHY_REG_BASE)
+
+#define FTHD_DDR_PHY_DEFAULT	0
+#define FTHD_DDR_PHY_CACHE	1
+#define FTHD_DDR_PHY_SHMOO	2
+
+/*
+ * Per-machine PHY cache, loaded as facetimehd/ddr_phy-<DMI board>.bin and
+ * produced by reading the ddr_phy debugfs file after a successful shmoo.
+ */
+#define FTHD_DDR_CACHE_MAGIC	0x52444446 /* "FDDR" */
+#define FTHD_DDR_CACHE_VERSION	1
+
+struct fthd_ddr_cache {
+	u32 magic;
+	u32 version;
+	u32 ddr_model;
+	u32 ddr_speed;
+	u32 sensor_id0;
+	u32 sensor_id1;
+	u32 num_regs;
+	u32 regs[DDR_PHY_NUM_REG];
+};
+
+/* Host access to S2 memory benchmark */
+#define FTHD_DDR_BENCH_MAPS	2	/* uncached, write-combined */
+#define FTHD_DDR_BENCH_XFERS	5	/* 4 (32-bit MMIO), 64, 512, 4k, 64k */
+#define FTHD_DDR_BENCH_LAT_NUM	1024
+#define FTHD_DDR_BENCH_DEFAULT	(1 * 1024 * 1024)
+#define FTHD_DDR_BENCH_MAX	(16 * 1024 * 1024)
+
+struct fthd_ddr_bench_xfer {
+	u32 xfer;
+	u64 write_ns;
+	u64 read_ns;
+};
+
+struct fthd_ddr_bench_result {
+	int valid;
+	u32 size;
+	int maps;	/* 1 if no write-combined mapping could be made */
+	struct fthd_ddr_bench_xfer bw[FTHD_DDR_BENCH_MAPS][FTHD_DDR_BENCH_XFERS];
+	/* Single 32-bit read and write+readback latency */
+	u64 rd_min_ns[FTHD_DDR_BENCH_MAPS];
+	u64 rd_avg_ns[FTHD_DDR_BENCH_MAPS];
+	u64 rd_max_ns[FTHD_DDR_BENCH_MAPS];
+	u64 wr_min_ns[FTHD_DDR_BENCH_MAPS];
+	u64 wr_avg_ns[FTHD_DDR_BENCH_MAPS];
+	u64 wr_max_ns[FTHD_DDR_BENCH_MAPS];
+};
+
 int fthd_ddr_calibrate(struct fthd_private *dev_priv);
 int fthd_ddr_verify_mem(struct fthd_private *dev_priv, u32 base, int count);
+int fthd_ddr_phy_init(struct fthd_private *dev_priv);
+void fthd_ddr_cache_fill(struct fthd_private *dev_priv,
+			 struct fthd_ddr_cache *cache);
+void fthd_ddr_cache_check(struct fthd_private *dev_priv);
+int fthd_ddr_bench(struct fthd_private *dev_priv, u32 size,
+		   struct fthd_ddr_bench_result *res);
 
 #endif
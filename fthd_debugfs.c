@@ -10,11 +10,13 @@
 #include <linux/kernel.h>
 #include <linux/spinlock.h>
 #include <linux/debugfs.h>
+#include <linux/slab.h>
 #include "fthd_drv.h"
 #include "fthd_debugfs.h"
 #include "fthd_isp.h"
 #include "fthd_ringbuf.h"
 #include "fthd_hw.h"
+#include "fthd_fwlog.h"
 
 static ssize_t fthd_store_debug(struct file *file, const char __user *user_buf,
 				size_t count, loff_t *ppos)
@@ -22,6 +24,7 @@ static ssize_t fthd_store_debug(struct file *file, const char __user *user_buf,
 {
 	struct fthd_isp_debug_cmd cmd;
 	struct fthd_private *dev_priv = file->private_data;
+	struct fthd_debug_result *res = dev_priv->debug_result;
 	int ret, opcode;
 	char buf[64];
 	int len;
@@ -31,6 +34,8 @@ static ssize_t fthd_store_debug(struct file *file, const char __user *user_buf,
 		return -EFAULT;
 
 	buf[len] = '\0';
+	if (len && buf[len - 1] == '\n')
+		buf[len - 1] = '\0';
 
 	memset(&cmd, 0, sizeof(cmd));
 
@@ -77,21 +82,103 @@ static ssize_t fthd_store_debug(struct file *file, const char __user *user_buf,
 		return -EINVAL;
 	cmd.show_errors = 1;
 
-	ret = fthd_isp_debug_cmd(dev_priv, opcode, &cmd, sizeof(cmd), NULL);
+	len = sizeof(cmd);
+	ret = fthd_isp_debug_cmd(dev_priv, opcode, &cmd, sizeof(cmd), &len);
+
+	mutex_lock(&res->lock);
+	res->valid = 1;
+	res->opcode = opcode;
+	res->ret = ret;
+	res->resp = cmd;
+	mutex_unlock(&res->lock);
+
 	if (ret)
 		return ret;
 
 	return count;
 }
 
+static int fthd_debug_decode(char *buf, int size, struct fthd_debug_result *res)
+{
+	struct isp_debug_heap_statistics *heap = (void *)&res->resp;
+	int i, last, len = 0;
+
+	len += scnprintf(buf + len, size - len, "opcode: %d\nresult: %d\n",
+			 res->opcode, res->ret);
+
+	switch (res->opcode) {
+	case CISP_CMD_DEBUG_HEAP_STATISTICS:
+		len += scnprintf(buf + len, size - len,
+				 "heap (field names inferred):\n"
+				 "  size? arg[0]: %u\n  used? arg[1]: %u\n"
+				 "  free? arg[2]: %u\n  max used? arg[3]: %u\n"
+				 "  largest free? arg[4]: %u\n  allocs? arg[5]: %u\n"
+				 "  frees? arg[6]: %u\n",
+				 heap->size, heap->used, heap->free, heap->max_used,
+				 heap->largest_free, heap->allocs, heap->frees);
+		break;
+	case CISP_CMD_DEBUG_IRQ_STATISTICS:
+		for (i = 0; i < ISP_DEBUG_IRQ_LINES; i++) {
+			if (!res->resp.arg[i])
+				continue;
+			len += scnprintf(buf + len, size - len, "irq %d: %u\n",
+					 i, res->resp.arg[i]);
+		}
+		break;
+	}
+
+	/* Raw response words up to the last non-zero one */
+	for (last = ARRAY_SIZE(res->resp.arg) - 1; last >= 0; last--) {
+		if (res->resp.arg[last])
+			break;
+	}
+
+	for (i = 0; i <= last; i++)
+		len += scnprintf(buf + len, size - len, "arg[%d]: 0x%08x\n",
+				 i, res->resp.arg[i]);
+	return len;
+}
+
+static ssize_t fthd_read_debug(struct file *file, char __user *user_buf,
+			       size_t count, loff_t *ppos)
+{
+	struct fthd_private *dev_priv = file->private_data;
+	struct fthd_debug_result *res = dev_priv->debug_result;
+	ssize_t ret;
+	char *buf;
+	int len = 0;
+
+	buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	mutex_lock(&res->lock);
+	if (res->valid)
+		len = fthd_debug_decode(buf, PAGE_SIZE, res);
+	mutex_unlock(&res->lock);
+
+	ret = simple_read_from_buffer(user_buf, count, ppos, buf, len);
+	kfree(buf);
+	return ret;
+}
+
 
 static int seq_channel_read(struct seq_file *seq, struct fthd_private *dev_priv,
-			struct fw_channel *chan)
+			struct fw_channel **chanp)
 {
+	struct fw_channel *chan;
 	int i;
 	char pos;
 	u32 entry;
 
+	/* The channels are reallocated when the ISP is reset */
+	down_read(&dev_priv->cmd_rwsem);
+	chan = *chanp;
+	if (dev_priv->isp_dead || !chan) {
+		up_read(&dev_priv->cmd_rwsem);
+		return -ENODEV;
+	}
+
 	spin_lock_irq(&chan->lock);
 	for( i = 0; i < chan->size; i++) {
 		if (chan->ringbuf.idx == i)
@@ -106,6 +193,7 @@ static int seq_channel_read(struct seq_file *seq, struct fthd_private *dev_priv,
 			   FTHD_S2_MEM_READ(entry + FTHD_RINGBUF_RESPONSE_SIZE));
 	}
 	spin_unlock_irq(&chan->lock);
+	up_read(&dev_priv->cmd_rwsem);
 	return 0;
 }
 
@@ -113,53 +201,656 @@ static int seq_channel_terminal_read(struct seq_file *seq, void *data)
 
 {
 	struct fthd_private *dev_priv = dev_get_drvdata(seq->private);
-	return seq_channel_read(seq, dev_priv, dev_priv->channel_terminal);
+	return seq_channel_read(seq, dev_priv, &dev_priv->channel_terminal);
 }
 
 static int seq_channel_sharedmalloc_read(struct seq_file *seq, void *data)
 
 {
 	struct fthd_private *dev_priv = dev_get_drvdata(seq->private);
-	return seq_channel_read(seq, dev_priv, dev_priv->channel_shared_malloc);
+	return seq_channel_read(seq, dev_priv, &dev_priv->channel_shared_malloc);
 }
 
 static int seq_channel_io_read(struct seq_file *seq, void *data)
 
 {
 	struct fthd_private *dev_priv = dev_get_drvdata(seq->private);
-	return seq_channel_read(seq, dev_priv, dev_priv->channel_io);
+	return seq_channel_read(seq, dev_priv, &dev_priv->channel_io);
 }
 
 static int seq_channel_io_t2h_read(struct seq_file *seq, void *data)
 
 {
 	struct fthd_private *dev_priv = dev_get_drvdata(seq->private);
-	return seq_channel_read(seq, dev_priv, dev_priv->channel_io_t2h);
+	return seq_channel_read(seq, dev_priv, &dev_priv->channel_io_t2h);
 }
 
 static int seq_channel_buf_h2t_read(struct seq_file *seq, void *data)
 
 {
 	struct fthd_private *dev_priv = dev_get_drvdata(seq->private);
-	return seq_channel_read(seq, dev_priv, dev_priv->channel_buf_h2t);
+	return seq_channel_read(seq, dev_priv, &dev_priv->channel_buf_h2t);
 }
 
 static int seq_channel_buf_t2h_read(struct seq_file *seq, void *data)
 
 {
 	struct fthd_private *dev_priv = dev_get_drvdata(seq->private);
-	return seq_channel_read(seq, dev_priv, dev_priv->channel_buf_t2h);
+	return seq_channel_read(seq, dev_priv, &dev_priv->channel_buf_t2h);
 }
 
 static int seq_channel_debug_read(struct seq_file *seq, void *data)
 
 {
 	struct fthd_private *dev_priv = dev_get_drvdata(seq->private);
-	return seq_channel_read(seq, dev_priv, dev_priv->channel_debug);
+	return seq_channel_read(seq, dev_priv, &dev_priv->channel_debug);
+}
+
+static int seq_ring_stats_read(struct seq_file *seq, void *data)
+{
+	struct fthd_private *dev_priv = dev_get_drvdata(seq->private);
+	struct fw_channel *chan;
+	struct fthd_ringbuf rb;
+	int i;
+
+	seq_printf(seq, "%-14s %4s %5s %5s %10s %10s %8s %8s %12s %10s\n",
+		   "CHANNEL", "SIZE", "DEPTH", "MAX", "SENT", "RECEIVED",
+		   "FULL", "TIMEOUTS", "WAIT_US", "IRQS");
+
+	down_read(&dev_priv->cmd_rwsem);
+	for (i = 0; !dev_priv->isp_dead && i < dev_priv->num_channels; i++) {
+		chan = dev_priv->channels[i];
+
+		spin_lock_irq(&chan->lock);
+		rb = chan->ringbuf;
+		spin_unlock_irq(&chan->lock);
+
+		seq_printf(seq, "%-14s %4d %5u %5u %10llu %10llu %8llu %8llu %12llu %10llu\n",
+			   chan->name, chan->size, rb.depth, rb.max_depth,
+			   rb.sent, rb.received, rb.full, rb.full_timeouts,
+			   div_u64(rb.full_wait_ns, NSEC_PER_USEC), rb.irqs);
+	}
+	up_read(&dev_priv->cmd_rwsem);
+	return 0;
+}
+
+static ssize_t fthd_read_fw_print(struct file *file, char __user *user_buf,
+				  size_t count, loff_t *ppos)
+{
+	struct fthd_private *dev_priv = file->private_data;
+	char buf[16];
+	int len;
+
+	len = scnprintf(buf, sizeof(buf), "%d\n", dev_priv->fw_print);
+	return simple_read_from_buffer(user_buf, count, ppos, buf, len);
+}
+
+static ssize_t fthd_store_fw_print(struct file *file, const char __user *user_buf,
+				   size_t count, loff_t *ppos)
+{
+	struct fthd_private *dev_priv = file->private_data;
+	bool enable;
+	int ret;
+
+	ret = kstrtobool_from_user(user_buf, count, &enable);
+	if (ret)
+		return ret;
+
+	ret = fthd_isp_cmd_print_enable(dev_priv, enable);
+	if (ret)
+		return ret;
+
+	dev_priv->fw_print = enable;
+	return count;
+}
+
+static ssize_t fthd_read_fw_debug_level(struct file *file, char __user *user_buf,
+					size_t count, loff_t *ppos)
+{
+	struct fthd_private *dev_priv = file->private_data;
+	char buf[16];
+	int len;
+
+	len = scnprintf(buf, sizeof(buf), "%d\n", dev_priv->fw_debug_level);
+	return simple_read_from_buffer(user_buf, count, ppos, buf, len);
+}
+
+static ssize_t fthd_store_fw_debug_level(struct file *file, const char __user *user_buf,
+					 size_t count, loff_t *ppos)
+{
+	struct fthd_private *dev_priv = file->private_data;
+	int level, ret;
+
+	ret = kstrtoint_from_user(user_buf, count, 0, &level);
+	if (ret)
+		return ret;
+
+	if (level < 0)
+		return -EINVAL;
+
+	ret = fthd_isp_set_debug_level(dev_priv, level);
+	if (ret)
+		return ret;
+
+	dev_priv->fw_debug_level = level;
+	return count;
+}
+
+/* TERMINAL interrupts since the last read of this file */
+static int seq_terminal_irq_rate_read(struct seq_file *seq, void *data)
+{
+	struct fthd_private *dev_priv = dev_get_drvdata(seq->private);
+	ktime_t now = ktime_get();
+	s64 us = ktime_us_delta(now, dev_priv->terminal_irqs_time);
+	u64 irqs, delta;
+
+	down_read(&dev_priv->cmd_rwsem);
+	if (dev_priv->isp_dead) {
+		up_read(&dev_priv->cmd_rwsem);
+		return -ENODEV;
+	}
+	irqs = dev_priv->channel_terminal->ringbuf.irqs;
+	up_read(&dev_priv->cmd_rwsem);
+
+	/* The counters start over when the ISP is reset */
+	if (irqs < dev_priv->terminal_irqs_last)
+		delta = irqs;
+	else
+		delta = irqs - dev_priv->terminal_irqs_last;
+
+	seq_printf(seq, "irqs: %llu\n", irqs);
+	if (dev_priv->terminal_irqs_time && us > 0)
+		seq_printf(seq, "rate: %llu/s over %lldms\n",
+			   div64_u64(delta * USEC_PER_SEC, us), div_s64(us, USEC_PER_MSEC));
+
+	dev_priv->terminal_irqs_last = irqs;
+	dev_priv->terminal_irqs_time = now;
+	return 0;
+}
+
+static int seq_frame_rate_read(struct seq_file *seq, void *data)
+{
+	struct fthd_private *dev_priv = dev_get_drvdata(seq->private);
+	u64 interval = READ_ONCE(dev_priv->frame_interval_ns);
+
+	seq_printf(seq, "requested: %u fps\n", dev_priv->fps);
+	if (dev_priv->variable_fps)
+		seq_printf(seq, "mode: variable, down to %u fps\n",
+			   min(dev_priv->min_fps, dev_priv->fps));
+	else
+		seq_printf(seq, "mode: constant\n");
+	if (interval)
+		seq_printf(seq, "delivered: %llu.%02llu fps\n",
+			   div64_u64(NSEC_PER_SEC, interval),
+			   div64_u64(NSEC_PER_SEC * 100ULL, interval) % 100);
+	else
+		seq_printf(seq, "delivered: -\n");
+	return 0;
+}
+
+static int seq_recovery_read(struct seq_file *seq, void *data)
+{
+	struct fthd_private *dev_priv = dev_get_drvdata(seq->private);
+
+	seq_printf(seq, "recoveries: %u\n", dev_priv->recoveries);
+	seq_printf(seq, "failures: %u\n", dev_priv->recovery_failures);
+	seq_printf(seq, "last: %llums\n", div_u64(dev_priv->recovery_last_ns, NSEC_PER_MSEC));
+	seq_printf(seq, "total: %llums\n", div_u64(dev_priv->recovery_total_ns, NSEC_PER_MSEC));
+	seq_printf(seq, "in progress: %d\n", atomic_read(&dev_priv->recovering));
+	return 0;
+}
+
+static int seq_probe_timing_read(struct seq_file *seq, void *data)
+{
+	struct fthd_private *dev_priv = dev_get_drvdata(seq->private);
+	u64 total = dev_priv->probe_total_ns;
+	int i;
+
+	seq_printf(seq, "%-18s %10s %5s\n", "PHASE", "US", "%");
+	for (i = 0; i < FTHD_PROBE_PHASES; i++)
+		seq_printf(seq, "%-18s %10llu %5llu\n", fthd_probe_phase_names[i],
+			   div_u64(dev_priv->probe_ns[i], NSEC_PER_USEC),
+			   total ? div64_u64(dev_priv->probe_ns[i] * 100, total) : 0);
+	seq_printf(seq, "%-18s %10llu\n", "total", div_u64(total, NSEC_PER_USEC));
+	return 0;
+}
+
+static int seq_cmd_stats_read(struct seq_file *seq, void *data)
+{
+	struct fthd_private *dev_priv = seq->private;
+	struct fthd_cmd_stats stats;
+	int i, j;
+
+	seq_printf(seq, "%-6s %8s %6s %8s %10s %10s %10s\n",
+		   "OPCODE", "COUNT", "ERRORS", "TIMEOUTS", "MIN_US", "AVG_US", "MAX_US");
+
+	for (i = 0; i < FTHD_CMD_STATS_SLOTS; i++) {
+		spin_lock_irq(&dev_priv->cmd_stats_lock);
+		stats = dev_priv->cmd_stats[i];
+		spin_unlock_irq(&dev_priv->cmd_stats_lock);
+
+		if (!stats.used)
+			break;
+
+		seq_printf(seq, "0x%04x %8llu %6llu %8llu %10llu %10llu %10llu\n",
+			   stats.opcode, stats.count, stats.errors, stats.timeouts,
+			   div_u64(stats.min_ns, NSEC_PER_USEC),
+			   stats.count ? div64_u64(stats.total_ns, stats.count * NSEC_PER_USEC) : 0,
+			   div_u64(stats.max_ns, NSEC_PER_USEC));
+
+		for (j = 0; j < FTHD_CMD_STATS_BUCKETS; j++) {
+			if (!stats.hist[j])
+				continue;
+			seq_printf(seq, "       < %8luus: %u\n", 1UL << j, stats.hist[j]);
+		}
+	}
+	return 0;
 }
 
+static int fthd_cmd_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, seq_cmd_stats_read, inode->i_private);
+}
+
+static ssize_t fthd_store_cmd_stats(struct file *file, const char __user *user_buf,
+				    size_t count, loff_t *ppos)
+{
+	struct seq_file *seq = file->private_data;
+	struct fthd_private *dev_priv = seq->private;
+
+	/* Any write resets the statistics */
+	spin_lock_irq(&dev_priv->cmd_stats_lock);
+	memset(dev_priv->cmd_stats, 0, sizeof(dev_priv->cmd_stats));
+	spin_unlock_irq(&dev_priv->cmd_stats_lock);
+	return count;
+}
+
+static const struct file_operations fops_cmd_stats = {
+	.read = seq_read,
+	.write = fthd_store_cmd_stats,
+	.open = fthd_cmd_stats_open,
+	.release = single_release,
+	.owner = THIS_MODULE,
+	.llseek = seq_lseek,
+};
+
+/*
+ * Profiling session. "start" enables firmware time profiling and the
+ * firmware CPU performance counters, "stop" disables both and fetches the
+ * results. Reading shows the results of the last completed session.
+ */
+static int fthd_profile_start(struct fthd_private *dev_priv, struct fthd_profile *prof)
+{
+	struct fthd_isp_debug_cmd cmd;
+	int ret;
+
+	if (prof->running)
+		return -EBUSY;
+
+	ret = fthd_isp_cmd_timeprofile_start(dev_priv);
+	if (ret)
+		return ret;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.show_errors = 1;
+	ret = fthd_isp_debug_cmd(dev_priv, CISP_CMD_DEBUG_START_CPU_PERFORMANCE_COUNTER,
+				 &cmd, sizeof(cmd), NULL);
+	if (ret) {
+		fthd_isp_cmd_timeprofile_stop(dev_priv);
+		return ret;
+	}
+
+	prof->running = 1;
+	prof->start = ktime_get();
+	return 0;
+}
+
+static int fthd_profile_stop(struct fthd_private *dev_priv, struct fthd_profile *prof)
+{
+	int ret, len;
+
+	if (!prof->running)
+		return -EINVAL;
+
+	prof->running = 0;
+	prof->valid = 0;
+	prof->duration_ns = ktime_to_ns(ktime_sub(ktime_get(), prof->start));
+
+	memset(&prof->perf, 0, sizeof(prof->perf));
+	prof->perf.show_errors = 1;
+	len = sizeof(prof->perf);
+	ret = fthd_isp_debug_cmd(dev_priv, CISP_CMD_DEBUG_STOP_CPU_PERFORMANCE_COUNTER,
+				 &prof->perf, sizeof(prof->perf), &len);
+	if (ret)
+		dev_warn(&dev_priv->pdev->dev, "failed to stop cpu performance counters: %d\n", ret);
+
+	ret = fthd_isp_cmd_timeprofile_stop(dev_priv);
+	if (ret)
+		return ret;
+
+	ret = fthd_isp_cmd_timeprofile_show(dev_priv, &prof->show);
+	if (ret)
+		return ret;
+
+	prof->valid = 1;
+	return 0;
+}
+
+static ssize_t fthd_store_profile(struct file *file, const char __user *user_buf,
+				  size_t count, loff_t *ppos)
+{
+	struct seq_file *seq = file->private_data;
+	struct fthd_private *dev_priv = seq->private;
+	struct fthd_profile *prof = dev_priv->profile;
+	char buf[16];
+	int len, ret;
+
+	len = min(count, sizeof(buf) - 1);
+	if (copy_from_user(buf, user_buf, len))
+		return -EFAULT;
+
+	buf[len] = '\0';
+	if (len && buf[len - 1] == '\n')
+		buf[len - 1] = '\0';
+
+	mutex_lock(&prof->lock);
+	if (!strcmp(buf, "start"))
+		ret = fthd_profile_start(dev_priv, prof);
+	else if (!strcmp(buf, "stop"))
+		ret = fthd_profile_stop(dev_priv, prof);
+	else
+		ret = -EINVAL;
+	mutex_unlock(&prof->lock);
+
+	return ret ? ret : count;
+}
+
+static int seq_profile_read(struct seq_file *seq, void *data)
+{
+	struct fthd_private *dev_priv = seq->private;
+	struct fthd_profile *prof = dev_priv->profile;
+	struct isp_timeprofile_stage *st;
+	u32 *raw = (u32 *)&prof->show;
+	int i, last;
+
+	mutex_lock(&prof->lock);
+	if (prof->running) {
+		seq_printf(seq, "running for %lldms\n",
+			   ktime_ms_delta(ktime_get(), prof->start));
+		goto out;
+	}
+
+	if (!prof->valid) {
+		seq_puts(seq, "no results\n");
+		goto out;
+	}
+
+	seq_printf(seq, "duration: %llums\n", div_u64(prof->duration_ns, NSEC_PER_MSEC));
+	seq_puts(seq, "stages (layout guessed, check against show[] below):\n");
+	seq_printf(seq, "%5s %10s %12s %10s %10s %10s\n",
+		   "STAGE", "COUNT", "TOTAL", "AVG", "MIN", "MAX");
+
+	for (i = 0; i < min_t(u32, prof->show.num_stages, ISP_TIMEPROFILE_STAGES); i++) {
+		st = prof->show.stage + i;
+		seq_printf(seq, "%5u %10u %12u %10u %10u %10u\n",
+			   st->id, st->count, st->total,
+			   st->count ? st->total / st->count : 0,
+			   st->min, st->max);
+	}
+
+	/* Raw TIMEPROFILE_SHOW response up to the last non-zero word */
+	for (last = sizeof(prof->show) / sizeof(u32) - 1; last >= 0; last--) {
+		if (raw[last])
+			break;
+	}
+
+	for (i = 0; i <= last; i++)
+		seq_printf(seq, "show[%d]: 0x%08x\n", i, raw[i]);
+
+	for (last = ARRAY_SIZE(prof->perf.arg) - 1; last >= 0; last--) {
+		if (prof->perf.arg[last])
+			break;
+	}
+
+	for (i = 0; i <= last; i++)
+		seq_printf(seq, "perf[%d]: %u\n", i, prof->perf.arg[i]);
+out:
+	mutex_unlock(&prof->lock);
+	return 0;
+}
+
+static int fthd_profile_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, seq_profile_read, inode->i_private);
+}
+
+static const struct file_operations fops_profile = {
+	.read = seq_read,
+	.write = fthd_store_profile,
+	.open = fthd_profile_open,
+	.release = single_release,
+	.owner = THIS_MODULE,
+	.llseek = seq_lseek,
+};
+
+#define FTHD_PING_DEFAULT_COUNT 1000
+
+static ssize_t fthd_store_ping(struct file *file, const char __user *user_buf,
+			       size_t count, loff_t *ppos)
+{
+	struct seq_file *seq = file->private_data;
+	struct fthd_private *dev_priv = seq->private;
+	struct fthd_bench *bench = dev_priv->bench;
+	struct fthd_ping_result *res;
+	struct fw_channel *chan;
+	char buf[32], name[8];
+	int n = FTHD_PING_DEFAULT_COUNT;
+	int len, ret;
+
+	len = min(count, sizeof(buf) - 1);
+	if (copy_from_user(buf, user_buf, len))
+		return -EFAULT;
+	buf[len] = '\0';
+
+	if (sscanf(buf, "%7s %i", name, &n) < 1 || n < 1 || n > FTHD_PING_MAX_COUNT)
+		return -EINVAL;
+
+	if (!strcmp(name, "io")) {
+		chan = dev_priv->channel_io;
+		res = bench->ping[0];
+	} else if (!strcmp(name, "debug")) {
+		chan = dev_priv->channel_debug;
+		res = bench->ping[1];
+	} else {
+		return -EINVAL;
+	}
+
+	mutex_lock(&bench->lock);
+	ret = fthd_isp_ping(dev_priv, chan, n, 1, &res[0]);
+	if (!ret)
+		ret = fthd_isp_ping(dev_priv, chan, n, FTHD_PING_MAX_DEPTH, &res[1]);
+	mutex_unlock(&bench->lock);
+
+	return ret ? ret : count;
+}
+
+static int seq_ping_read(struct seq_file *seq, void *data)
+{
+	struct fthd_private *dev_priv = seq->private;
+	struct fthd_bench *bench = dev_priv->bench;
+	static const char * const names[] = { "io", "debug" };
+	struct fthd_ping_result *res;
+	int i, j;
+
+	seq_printf(seq, "%-6s %5s %7s %6s %10s %10s %10s %10s %8s\n",
+		   "CHAN", "DEPTH", "COUNT", "ERRORS", "MIN_US", "MEDIAN_US",
+		   "P99_US", "CMDS/S", "TOTAL_MS");
+
+	mutex_lock(&bench->lock);
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < 2; j++) {
+			res = &bench->ping[i][j];
+			if (!res->valid)
+				continue;
+
+			seq_printf(seq, "%-6s %5d %7d %6d %10llu %10llu %10llu %10llu %8llu\n",
+				   names[i], res->depth, res->count, res->errors,
+				   div_u64(res->min_ns, NSEC_PER_USEC),
+				   div_u64(res->median_ns, NSEC_PER_USEC),
+				   div_u64(res->p99_ns, NSEC_PER_USEC),
+				   res->total_ns ? div64_u64((u64)res->count * NSEC_PER_SEC, res->total_ns) : 0,
+				   div_u64(res->total_ns, NSEC_PER_MSEC));
+		}
+	}
+	mutex_unlock(&bench->lock);
+	return 0;
+}
+
+static int fthd_ping_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, seq_ping_read, inode->i_private);
+}
+
+static const struct file_operations fops_ping = {
+	.read = seq_read,
+	.write = fthd_store_ping,
+	.open = fthd_ping_open,
+	.release = single_release,
+	.owner = THIS_MODULE,
+	.llseek = seq_lseek,
+};
+
+static ssize_t fthd_store_ddr_bench(struct file *file, const char __user *user_buf,
+				    size_t count, loff_t *ppos)
+{
+	struct seq_file *seq = file->private_data;
+	struct fthd_private *dev_priv = seq->private;
+	struct fthd_bench *bench = dev_priv->bench;
+	unsigned int kb = FTHD_DDR_BENCH_DEFAULT / 1024;
+	char buf[32];
+	int len, ret;
+
+	len = min(count, sizeof(buf) - 1);
+	if (copy_from_user(buf, user_buf, len))
+		return -EFAULT;
+	buf[len] = '\0';
+
+	/* Optional region size in kb, anything else just runs the default */
+	if (sscanf(buf, "%u", &kb) == 1 && (!kb || kb > FTHD_DDR_BENCH_MAX / 1024))
+		return -EINVAL;
+
+	mutex_lock(&bench->lock);
+	ret = fthd_ddr_bench(dev_priv, kb * 1024, &bench->ddr);
+	mutex_unlock(&bench->lock);
+
+	return ret ? ret : count;
+}
+
+static u64 fthd_ddr_bench_mbps(u32 size, u64 ns)
+{
+	return ns ? div64_u64((u64)size * NSEC_PER_SEC, ns * 1000 * 1000) : 0;
+}
+
+static int seq_ddr_bench_read(struct seq_file *seq, void *data)
+{
+	struct fthd_private *dev_priv = seq->private;
+	struct fthd_ddr_bench_result *res = &dev_priv->bench->ddr;
+	static const char * const maps[] = { "uc", "wc" };
+	struct fthd_ddr_bench_xfer *bw;
+	int i, j;
+
+	mutex_lock(&dev_priv->bench->lock);
+	if (!res->valid)
+		goto out;
+
+	seq_printf(seq, "size: %ukb\n\n", res->size / 1024);
+	seq_printf(seq, "%-4s %6s %-7s %10s %10s\n",
+		   "MAP", "XFER", "METHOD", "WRITE_MB/S", "READ_MB/S");
+
+	for (i = 0; i < res->maps; i++) {
+		for (j = 0; j < FTHD_DDR_BENCH_XFERS; j++) {
+			bw = &res->bw[i][j];
+			seq_printf(seq, "%-4s %6u %-7s %10llu %10llu\n",
+				   maps[i], bw->xfer,
+				   bw->xfer == 4 ? "mmio32" : "memcpy",
+				   fthd_ddr_bench_mbps(res->size, bw->write_ns),
+				   fthd_ddr_bench_mbps(res->size, bw->read_ns));
+		}
+	}
+
+	seq_printf(seq, "\n%-4s %-6s %8s %8s %8s\n",
+		   "MAP", "OP", "MIN_NS", "AVG_NS", "MAX_NS");
+	for (i = 0; i < res->maps; i++) {
+		seq_printf(seq, "%-4s %-6s %8llu %8llu %8llu\n", maps[i], "read",
+			   res->rd_min_ns[i], res->rd_avg_ns[i], res->rd_max_ns[i]);
+		seq_printf(seq, "%-4s %-6s %8llu %8llu %8llu\n", maps[i], "write",
+			   res->wr_min_ns[i], res->wr_avg_ns[i], res->wr_max_ns[i]);
+	}
+
+	if (res->maps < FTHD_DDR_BENCH_MAPS)
+		seq_puts(seq, "\nwc: not measured, no write-combined alias of the BAR mapping\n");
+out:
+	mutex_unlock(&dev_priv->bench->lock);
+	return 0;
+}
+
+static int fthd_ddr_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, seq_ddr_bench_read, inode->i_private);
+}
+
+static const struct file_operations fops_ddr_bench = {
+	.read = seq_read,
+	.write = fthd_store_ddr_bench,
+	.open = fthd_ddr_bench_open,
+	.release = single_release,
+	.owner = THIS_MODULE,
+	.llseek = seq_lseek,
+};
+
+/* Binary PHY cache blob, meant to be saved as the firmware file */
+static ssize_t fthd_read_ddr_phy(struct file *file, char __user *user_buf,
+				 size_t count, loff_t *ppos)
+{
+	struct fthd_private *dev_priv = file->private_data;
+	struct fthd_ddr_cache *cache;
+	ssize_t ret;
+
+	cache = kmalloc(sizeof(*cache), GFP_KERNEL);
+	if (!cache)
+		return -ENOMEM;
+
+	fthd_ddr_cache_fill(dev_priv, cache);
+	ret = simple_read_from_buffer(user_buf, count, ppos, cache, sizeof(*cache));
+	kfree(cache);
+	return ret;
+}
+
+static const struct file_operations fops_ddr_phy = {
+	.read = fthd_read_ddr_phy,
+	.open = simple_open,
+	.owner = THIS_MODULE,
+	.llseek = default_llseek,
+};
+
+static const struct file_operations fops_fw_print = {
+	.read = fthd_read_fw_print,
+	.write = fthd_store_fw_print,
+	.open = simple_open,
+	.owner = THIS_MODULE,
+	.llseek = default_llseek,
+};
+
+static const struct file_operations fops_fw_debug_level = {
+	.read = fthd_read_fw_debug_level,
+	.write = fthd_store_fw_debug_level,
+	.open = simple_open,
+	.owner = THIS_MODULE,
+	.llseek = default_llseek,
+};
+
 static const struct file_operations fops_debug = {
-	.read = NULL,
+	.read = fthd_read_debug,
 	.write = fthd_store_debug,
 	.open = simple_open,
 	.owner = THIS_MODULE,
@@ -170,6 +861,24 @@ int fthd_debugfs_init(struct fthd_private *dev_priv)
 {
 	struct dentry *d, *top;
 
+	dev_priv->debug_result = devm_kzalloc(&dev_priv->pdev->dev,
+					      sizeof(*dev_priv->debug_result), GFP_KERNEL);
+	if (!dev_priv->debug_result)
+		return -ENOMEM;
+	mutex_init(&dev_priv->debug_result->lock);
+
+	dev_priv->profile = devm_kzalloc(&dev_priv->pdev->dev,
+					 sizeof(*dev_priv->profile), GFP_KERNEL);
+	if (!dev_priv->profile)
+		return -ENOMEM;
+	mutex_init(&dev_priv->profile->lock);
+
+	dev_priv->bench = devm_kzalloc(&dev_priv->pdev->dev,
+				       sizeof(*dev_priv->bench), GFP_KERNEL);
+	if (!dev_priv->bench)
+		return -ENOMEM;
+	mutex_init(&dev_priv->bench->lock);
+
 	top = debugfs_create_dir("facetimehd", NULL);
 	if (IS_ERR(top))
 		return PTR_ERR(top);
@@ -187,6 +896,21 @@ int fthd_debugfs_init(struct fthd_private *dev_priv)
 	debugfs_create_devm_seqfile(&dev_priv->pdev->dev, "channel_buf_h2t", d, seq_channel_buf_h2t_read);
 	debugfs_create_devm_seqfile(&dev_priv->pdev->dev, "channel_buf_t2h", d, seq_channel_buf_t2h_read);
 	debugfs_create_devm_seqfile(&dev_priv->pdev->dev, "channel_debug", d, seq_channel_debug_read);
+	debugfs_create_devm_seqfile(&dev_priv->pdev->dev, "ring_stats", d, seq_ring_stats_read);
+	debugfs_create_devm_seqfile(&dev_priv->pdev->dev, "recovery", d, seq_recovery_read);
+	debugfs_create_devm_seqfile(&dev_priv->pdev->dev, "probe_timing", d, seq_probe_timing_read);
+	debugfs_create_file("cmd_stats", S_IRUSR | S_IWUSR, d, dev_priv, &fops_cmd_stats);
+	debugfs_create_file("fwlog", S_IRUSR, d, dev_priv, &fthd_fwlog_fops);
+	debugfs_create_u64("fwlog_dropped", S_IRUSR, d, &dev_priv->fwlog->hdr->dropped);
+	debugfs_create_file("fw_print", S_IRUSR | S_IWUSR, d, dev_priv, &fops_fw_print);
+	debugfs_create_file("fw_debug_level", S_IRUSR | S_IWUSR, d, dev_priv, &fops_fw_debug_level);
+	debugfs_create_devm_seqfile(&dev_priv->pdev->dev, "terminal_irq_rate", d, seq_terminal_irq_rate_read);
+	debugfs_create_devm_seqfile(&dev_priv->pdev->dev, "frame_rate", d, seq_frame_rate_read);
+	debugfs_create_file("profile", S_IRUSR | S_IWUSR, d, dev_priv, &fops_profile);
+	debugfs_create_file("ping", S_IRUSR | S_IWUSR, d, dev_priv, &fops_ping);
+	debugfs_create_file("ddr_bench", S_IRUSR | S_IWUSR, d, dev_priv,
+			    &fops_ddr_bench);
+	debugfs_create_file("ddr_phy", S_IRUSR, d, dev_priv, &fops_ddr_phy);
 	debugfs_create_file("debug", S_IRUSR | S_IWUSR, d, dev_priv, &fops_debug);
 	dev_priv->debugfs = top;
 	return 0;
@@ -10,8 +10,41 @@
 #ifndef _FTHD_SYSFS_H
 #define _FTHD_SYSFS_H
 
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include "fthd_isp.h"
+#include "fthd_ddr.h"
+
 struct fthd_private;
 
+/* Response of the last command sent through the "debug" file */
+struct fthd_debug_result {
+	struct mutex lock;
+	int valid;
+	int opcode;
+	int ret;
+	struct fthd_isp_debug_cmd resp;
+};
+
+/* State of a profiling session started through the "profile" file */
+struct fthd_profile {
+	struct mutex lock;
+	int running;
+	int valid;
+	ktime_t start;
+	u64 duration_ns;
+	struct isp_cmd_timeprofile_show show;
+	struct fthd_isp_debug_cmd perf;
+};
+
+/* Results of the benchmarks started through debugfs */
+struct fthd_bench {
+	struct mutex lock;
+	/* [io, debug][serial, pipelined] */
+	struct fthd_ping_result ping[2][2];
+	struct fthd_ddr_bench_result ddr;
+};
+
 int fthd_debugfs_init(struct fthd_private *priv);
 void fthd_debugfs_exit(struct fthd_private *priv);
 #endif
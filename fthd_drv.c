@@ -24,11 +24,17 @@
 #include <linux/videodev2.h>
 #include "fthd_drv.h"
 #include "fthd_hw.h"
+#include "fthd_ddr.h"
 #include "fthd_isp.h"
 #include "fthd_ringbuf.h"
 #include "fthd_buffer.h"
 #include "fthd_v4l2.h"
 #include "fthd_debugfs.h"
+#include "fthd_fwlog.h"
+#include "fthd_meta.h"
+
+#define CREATE_TRACE_POINTS
+#include "fthd_trace.h"
 
 static int fthd_pci_reserve_mem(struct fthd_private *dev_priv)
 {
@@ -127,6 +133,10 @@ static void sharedmalloc_handler(struct fthd_private *dev_priv,
 }
 
 
+static bool fwlog_printk;
+module_param(fwlog_printk, bool, 0644);
+MODULE_PARM_DESC(fwlog_printk, "Also print firmware messages to the kernel log");
+
 static void terminal_handler(struct fthd_private *dev_priv,
 				 struct fw_channel *chan,
 				 u32 entry)
@@ -143,6 +153,12 @@ static void terminal_handler(struct fthd_private *dev_priv,
 
 	if (request_size > 512)
 		request_size = 512;
+
+	fthd_fwlog_write(dev_priv, address, request_size);
+
+	if (!READ_ONCE(fwlog_printk))
+		return;
+
 	FTHD_S2_MEMCPY_FROMIO(buf, address, request_size);
 	pr_info("FWMSG: %.*s", request_size, buf);
 }
@@ -160,7 +176,7 @@ static void buf_t2h_handler(struct fthd_private *dev_priv,
 	if (address & 1)
 		return;
 
-
+	trace_fthd_buf_t2h(entry, address, request_size, response_size);
 	fthd_buffer_return_handler(dev_priv, address & ~3, request_size);
 	ret = fthd_channel_ringbuf_send(dev_priv, chan, (response_size & 0x10000000) ? address : 0,
 					0, 0x80000000, NULL);
@@ -169,40 +185,103 @@ static void buf_t2h_handler(struct fthd_private *dev_priv,
 
 }
 
+static int t2h_poll_budget;
+module_param(t2h_poll_budget, int, 0644);
+MODULE_PARM_DESC(t2h_poll_budget, "Poll BUF_T2H with its interrupt masked, handling up to this many frames per pass (0 = off)");
+
+/* Upper bound for a single poll pass before yielding the worker */
+#define FTHD_T2H_POLL_USECS	1000
+
+/*
+ * NAPI style polling of the BUF_T2H ring. While frames keep arriving the
+ * interrupt stays masked and we get called again from the workqueue. Once
+ * the ring is drained the interrupt is unmasked, and the ring is checked
+ * once more to catch entries that arrived while it was still masked.
+ */
+static void fthd_t2h_poll_work(struct work_struct *work)
+{
+	struct fthd_private *dev_priv = container_of(work, struct fthd_private, t2h_poll_work);
+	struct fw_channel *chan = dev_priv->channel_buf_t2h;
+	int budget = max(READ_ONCE(t2h_poll_budget), 1);
+	ktime_t end = ktime_add_us(ktime_get(), FTHD_T2H_POLL_USECS);
+	u32 entry;
+	int count = 0;
+
+	while ((entry = fthd_channel_ringbuf_receive(dev_priv, chan)) != (u32)-1) {
+		buf_t2h_handler(dev_priv, chan, entry);
+		if (++count >= budget || ktime_after(ktime_get(), end))
+			break;
+	}
+
+	if (count)
+		fthd_channel_ringbuf_account_rx(dev_priv, chan, count);
+
+	if (entry != (u32)-1) {
+		/* Out of budget, there might be more */
+		schedule_work(&dev_priv->t2h_poll_work);
+		return;
+	}
+
+	atomic_set(&dev_priv->t2h_polling, 0);
+	fthd_irq_source_mask(dev_priv, chan->source, 0);
+
+	if (fthd_channel_ringbuf_receive(dev_priv, chan) != (u32)-1 &&
+	    !atomic_xchg(&dev_priv->t2h_polling, 1)) {
+		fthd_irq_source_mask(dev_priv, chan->source, 1);
+		schedule_work(&dev_priv->t2h_poll_work);
+	}
+}
+
 static void io_t2h_handler(struct fthd_private *dev_priv,
 				 struct fw_channel *chan,
 				 u32 entry)
 {
-	int ret = fthd_channel_ringbuf_send(dev_priv, chan, 0, 0, 0, NULL);
+	u32 request_size, address;
+	int ret;
+
+	request_size = FTHD_S2_MEM_READ(entry + FTHD_RINGBUF_REQUEST_SIZE);
+	address = FTHD_S2_MEM_READ(entry + FTHD_RINGBUF_ADDRESS_FLAGS);
+	if (!(address & 1) && (address & ~3))
+		fthd_isp_notify_handler(dev_priv, address & ~3, request_size);
+
+	ret = fthd_channel_ringbuf_send(dev_priv, chan, 0, 0, 0, NULL);
 	if (ret)
 		pr_err("%s: fthd_channel_ringbuf_send: %d\n", __FUNCTION__, ret);
 
 }
 
-static void fthd_handle_irq(struct fthd_private *dev_priv, struct fw_channel *chan)
+static void fthd_handle_irq(struct fthd_private *dev_priv, struct fw_channel *chan,
+			    u32 pending)
 {
 	u32 entry;
-	int ret;
+	int ret, count = 0;
+
+	trace_fthd_handle_irq(chan->name, chan->source, pending);
+	chan->ringbuf.irqs++;
 
 	if (chan == dev_priv->channel_io) {
 		pr_debug("IO channel ready\n");
+		fthd_channel_ringbuf_reap(dev_priv, chan);
 		wake_up_interruptible(&chan->wq);
 		return;
 	}
 
 	if (chan == dev_priv->channel_buf_h2t) {
 		pr_debug("H2T channel ready\n");
+		fthd_channel_ringbuf_reap(dev_priv, chan);
 		wake_up_interruptible(&chan->wq);
 		return;
 	}
 
 	if (chan == dev_priv->channel_debug) {
 		pr_debug("DEBUG channel ready\n");
+		fthd_channel_ringbuf_reap(dev_priv, chan);
 		wake_up_interruptible(&chan->wq);
 		return;
 	}
 
 	while((entry = fthd_channel_ringbuf_receive(dev_priv, chan)) != (u32)-1) {
+		count++;
 		pr_debug("channel %s: message available, address %08x\n", chan->name, FTHD_S2_MEM_READ(entry + FTHD_RINGBUF_ADDRESS_FLAGS));
 		if (chan == dev_priv->channel_shared_malloc) {
 			sharedmalloc_handler(dev_priv, chan, entry);
@@ -217,6 +296,9 @@ static void fthd_handle_irq(struct fthd_private *dev_priv, struct fw_channel *ch
 			io_t2h_handler(dev_priv, chan, entry);
 		}
 	}
+
+	if (count)
+		fthd_channel_ringbuf_account_rx(dev_priv, chan, count);
 }
 
 static void fthd_irq_uninstall(struct fthd_private *dev_priv)
@@ -230,7 +312,7 @@ static void fthd_irq_work(struct work_struct *work)
 	struct fw_channel *chan;
 
 	u32 pending;
-	int i = 0;
+	int i = 0, j;
 
 	while(i++ < 500) {
 		spin_lock_irq(&dev_priv->io_lock);
@@ -240,26 +322,46 @@ static void fthd_irq_work(struct work_struct *work)
 		if (!(pending & 0xf0))
 			break;
 
+		trace_fthd_irq_work(pending, i);
+
 		pci_write_config_dword(dev_priv->pdev, 0x94, 0);
 		spin_lock_irq(&dev_priv->io_lock);
 		FTHD_ISP_REG_WRITE(pending, ISP_IRQ_CLEAR);
 		spin_unlock_irq(&dev_priv->io_lock);
 		pci_write_config_dword(dev_priv->pdev, 0x90, 0x200);
 
-		for(i = 0; i < dev_priv->num_channels; i++) {
-			chan = dev_priv->channels[i];
+		for(j = 0; j < dev_priv->num_channels; j++) {
+			chan = dev_priv->channels[j];
 
 
 			BUG_ON(chan->source > 3);
 			if (!((0x10 << chan->source) & pending))
 				continue;
-			fthd_handle_irq(dev_priv, chan);
+
+			/*
+			 * Leave the ring to the poller while it runs, even if
+			 * polling was turned off meanwhile, so an entry is never
+			 * handled twice.
+			 */
+			if (chan == dev_priv->channel_buf_t2h &&
+			    (atomic_read(&dev_priv->t2h_polling) ||
+			     READ_ONCE(t2h_poll_budget) > 0)) {
+				if (!atomic_xchg(&dev_priv->t2h_polling, 1)) {
+					fthd_irq_source_mask(dev_priv, chan->source, 1);
+					schedule_work(&dev_priv->t2h_poll_work);
+				}
+				continue;
+			}
+			fthd_handle_irq(dev_priv, chan, pending);
 		}
 	}
 
-	if (i >= 500) {
-		dev_err(&dev_priv->pdev->dev, "irq stuck, disabling\n");
-		fthd_irq_uninstall(dev_priv);
+	/* i ends up past 500 only if every pass still found work pending */
+	if (i > 500) {
+		dev_err(&dev_priv->pdev->dev, "irq stuck, resetting ISP\n");
+		fthd_irq_disable(dev_priv);
+		fthd_schedule_recovery(dev_priv);
+		return;
 	}
 	pci_write_config_dword(dev_priv->pdev, 0x94, 0x200);
 }
@@ -274,6 +376,8 @@ static irqreturn_t fthd_irq_handler(int irq, void *arg)
 	pending = FTHD_ISP_REG_READ(ISP_IRQ_STATUS);
 	spin_unlock_irqrestore(&dev_priv->io_lock, flags);
 
+	trace_fthd_irq_handler(pending);
+
 	if (!(pending & 0xf0))
 		return IRQ_NONE;
 
@@ -326,22 +430,35 @@ static void fthd_pci_remove(struct pci_dev *pdev)
 	if (!dev_priv)
 		goto out;
 
+	dev_priv->recovery_disabled = 1;
+	cancel_work_sync(&dev_priv->recovery_work);
+	cancel_delayed_work_sync(&dev_priv->watchdog_work);
+
 	fthd_debugfs_exit(dev_priv);
 
 	fthd_v4l2_unregister(dev_priv);
 
-	fthd_stop_firmware(dev_priv);
+	/* A failed recovery has already torn the ISP down */
+	if (!dev_priv->isp_dead)
+		fthd_stop_firmware(dev_priv);
 
 	fthd_irq_uninstall(dev_priv);
 
 	cancel_work_sync(&dev_priv->irq_work);
+	cancel_work_sync(&dev_priv->t2h_poll_work);
 
-	isp_uninit(dev_priv);
+	/* No frames complete anymore */
+	fthd_meta_unregister(dev_priv);
+
+	if (!dev_priv->isp_dead)
+		isp_uninit(dev_priv);
 
 	fthd_hw_deinit(dev_priv);
 
 	fthd_buffer_exit(dev_priv);
 
+	fthd_fwlog_exit(dev_priv);
+
 	pci_disable_msi(pdev);
 
 	if (dev_priv->s2_io)
@@ -419,6 +536,22 @@ fail_enable:
 	return ret;
 }
 
+static bool fw_print;
+module_param(fw_print, bool, 0444);
+MODULE_PARM_DESC(fw_print, "Let the firmware print to the TERMINAL channel (default off)");
+
+static int fw_debug_level = -1;
+module_param(fw_debug_level, int, 0444);
+MODULE_PARM_DESC(fw_debug_level, "Firmware debug level for all objects (-1 = firmware default)");
+
+static bool multiplanar;
+module_param(multiplanar, bool, 0444);
+MODULE_PARM_DESC(multiplanar, "Use the multi-planar V4L2 API, needed for NV16M capture");
+
+static bool ddr_shmoo;
+module_param(ddr_shmoo, bool, 0444);
+MODULE_PARM_DESC(ddr_shmoo, "Calibrate the DDR PHY if its defaults fail verification (experimental, default off)");
+
 static int fthd_firmware_start(struct fthd_private *dev_priv)
 {
 	int ret;
@@ -426,34 +559,236 @@ static int fthd_firmware_start(struct fthd_private *dev_priv)
 	ret = fthd_isp_cmd_start(dev_priv);
 	if (ret)
 		return ret;
+	fthd_probe_mark(dev_priv, FTHD_PROBE_CMD_START);
 
-	ret = fthd_isp_cmd_print_enable(dev_priv, 1);
+	ret = fthd_isp_cmd_print_enable(dev_priv, dev_priv->fw_print);
 	if (ret)
 		return ret;
+	fthd_probe_mark(dev_priv, FTHD_PROBE_CMD_PRINT);
+
+	if (dev_priv->fw_debug_level >= 0 &&
+	    fthd_isp_set_debug_level(dev_priv, dev_priv->fw_debug_level))
+		dev_warn(&dev_priv->pdev->dev, "failed to set firmware debug level\n");
+	fthd_probe_mark(dev_priv, FTHD_PROBE_CMD_DEBUG_LEVEL);
 
 	ret = fthd_isp_cmd_camera_config(dev_priv);
 	if (ret)
 		return ret;
+	fthd_probe_mark(dev_priv, FTHD_PROBE_CMD_CAMERA_CONFIG);
 
 	ret = fthd_isp_cmd_channel_info(dev_priv);
 	if (ret)
 		return ret;
+	fthd_probe_mark(dev_priv, FTHD_PROBE_CMD_CHANNEL_INFO);
+
+	fthd_ddr_cache_check(dev_priv);
 
 	/* Query the sensor's native resolution now so fthd_v4l2_register()
 	 * can advertise it. Non-fatal: if it fails the V4L2 layer falls back
 	 * to a default size. */
 	fthd_isp_cmd_channel_camera_config(dev_priv);
+	fthd_probe_mark(dev_priv, FTHD_PROBE_CMD_SENSOR_CONFIG);
+
+	ret = fthd_isp_cmd_set_loadfile(dev_priv);
+	fthd_probe_mark(dev_priv, FTHD_PROBE_CMD_SET_FILE);
+	return ret;
+}
 
-	return fthd_isp_cmd_set_loadfile(dev_priv);
+static int watchdog_ms = 2000;
+module_param(watchdog_ms, int, 0644);
+MODULE_PARM_DESC(watchdog_ms, "Reset the ISP if no frame arrives for this many ms while streaming (0 = off)");
 
+#define FTHD_WATCHDOG_PERIOD 500 /* ms */
+
+void fthd_schedule_recovery(struct fthd_private *dev_priv)
+{
+	if (dev_priv->recovery_disabled || dev_priv->isp_dead)
+		return;
+
+	if (atomic_xchg(&dev_priv->recovering, 1))
+		return;
+
+	schedule_work(&dev_priv->recovery_work);
+}
+
+static void fthd_recovery_work(struct work_struct *work)
+{
+	struct fthd_private *dev_priv = container_of(work, struct fthd_private, recovery_work);
+	ktime_t start = ktime_get();
+	u64 ns;
+	int ret;
+
+	dev_warn(&dev_priv->pdev->dev, "firmware not responding, resetting ISP\n");
+
+	/* Keep userspace and control updates away from the firmware */
+	mutex_lock(&dev_priv->vb2_queue_lock);
+	mutex_lock(dev_priv->v4l2_ctrl_handler.lock);
+
+	fthd_irq_disable(dev_priv);
+	cancel_work_sync(&dev_priv->irq_work);
+	cancel_work_sync(&dev_priv->t2h_poll_work);
+	atomic_set(&dev_priv->t2h_polling, 0);
+
+	fthd_v4l2_recovery_prepare(dev_priv);
+
+	/* Wait for commands in flight, new ones block until the ISP is back */
+	down_write(&dev_priv->cmd_rwsem);
+	isp_uninit(dev_priv);
+	ret = isp_init(dev_priv);
+	if (ret) {
+		dev_priv->isp_dead = 1;
+		up_write(&dev_priv->cmd_rwsem);
+		goto fail;
+	}
+	fthd_irq_enable(dev_priv);
+	up_write(&dev_priv->cmd_rwsem);
+
+	ret = fthd_firmware_start(dev_priv);
+	if (ret)
+		goto fail_isp;
+
+	ret = fthd_v4l2_recovery_finish(dev_priv);
+	if (ret)
+		goto fail_isp;
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	dev_priv->recoveries++;
+	dev_priv->recovery_last_ns = ns;
+	dev_priv->recovery_total_ns += ns;
+	dev_info(&dev_priv->pdev->dev, "ISP recovered in %llums (%u recoveries)\n",
+		 div_u64(ns, NSEC_PER_MSEC), dev_priv->recoveries);
+	goto out;
+fail_isp:
+	fthd_irq_disable(dev_priv);
+	cancel_work_sync(&dev_priv->irq_work);
+	cancel_work_sync(&dev_priv->t2h_poll_work);
+	atomic_set(&dev_priv->t2h_polling, 0);
+	fthd_v4l2_recovery_prepare(dev_priv);
+
+	down_write(&dev_priv->cmd_rwsem);
+	dev_priv->isp_dead = 1;
+	isp_uninit(dev_priv);
+	up_write(&dev_priv->cmd_rwsem);
+fail:
+	/* Channels and ISP memory are gone, every command fails from now on */
+	dev_priv->recovery_failures++;
+	dev_err(&dev_priv->pdev->dev, "ISP recovery failed: %d, camera disabled\n", ret);
+	if (vb2_is_streaming(&dev_priv->vb2_queue))
+		vb2_queue_error(&dev_priv->vb2_queue);
+out:
+	dev_priv->watchdog_stall_ms = 0;
+	atomic_set(&dev_priv->recovering, 0);
+	mutex_unlock(dev_priv->v4l2_ctrl_handler.lock);
+	mutex_unlock(&dev_priv->vb2_queue_lock);
+}
+
+/* Check for frame progress while streaming with buffers handed to the firmware */
+static void fthd_watchdog_work(struct work_struct *work)
+{
+	struct fthd_private *dev_priv = container_of(to_delayed_work(work),
+						     struct fthd_private, watchdog_work);
+	int i, queued = 0, timeout, frametime;
+
+	for (i = 0; i < FTHD_BUFFERS; i++) {
+		if (dev_priv->h2t_bufs[i].state == BUF_HW_QUEUED)
+			queued++;
+	}
+
+	if (!queued || dev_priv->sequence != dev_priv->watchdog_sequence ||
+	    atomic_read(&dev_priv->recovering)) {
+		dev_priv->watchdog_sequence = dev_priv->sequence;
+		dev_priv->watchdog_stall_ms = 0;
+		goto out;
+	}
+
+	dev_priv->watchdog_stall_ms += FTHD_WATCHDOG_PERIOD;
+
+	/* Allow at least a few frame times at low frame rates */
+	frametime = dev_priv->frametime;
+	if (dev_priv->variable_fps)
+		frametime = max_t(int, frametime, 1000 / dev_priv->min_fps);
+	timeout = max(READ_ONCE(watchdog_ms), frametime * 10);
+	if (READ_ONCE(watchdog_ms) > 0 && dev_priv->watchdog_stall_ms >= timeout) {
+		dev_err(&dev_priv->pdev->dev, "no frame for %ums\n",
+			dev_priv->watchdog_stall_ms);
+		dev_priv->watchdog_stall_ms = 0;
+		fthd_schedule_recovery(dev_priv);
+	}
+out:
+	schedule_delayed_work(&dev_priv->watchdog_work,
+			      msecs_to_jiffies(FTHD_WATCHDOG_PERIOD));
+}
+
+void fthd_watchdog_start(struct fthd_private *dev_priv)
+{
+	dev_priv->watchdog_sequence = dev_priv->sequence;
+	dev_priv->watchdog_stall_ms = 0;
+	schedule_delayed_work(&dev_priv->watchdog_work,
+			      msecs_to_jiffies(FTHD_WATCHDOG_PERIOD));
+}
+
+void fthd_watchdog_stop(struct fthd_private *dev_priv)
+{
+	cancel_delayed_work_sync(&dev_priv->watchdog_work);
+}
+
+const char * const fthd_probe_phase_names[FTHD_PROBE_PHASES] = {
+	[FTHD_PROBE_PCI] = "pci",
+	[FTHD_PROBE_BUFFER] = "buffer",
+	[FTHD_PROBE_DDR_INIT] = "ddr_init",
+	[FTHD_PROBE_DDR_VERIFY] = "ddr_verify",
+	[FTHD_PROBE_FW_UPLOAD] = "fw_upload",
+	[FTHD_PROBE_ISP_WAKE] = "isp_wake",
+	[FTHD_PROBE_ISP_BOOT] = "isp_boot",
+	[FTHD_PROBE_CMD_START] = "cmd_start",
+	[FTHD_PROBE_CMD_PRINT] = "cmd_print",
+	[FTHD_PROBE_CMD_DEBUG_LEVEL] = "cmd_debug_level",
+	[FTHD_PROBE_CMD_CAMERA_CONFIG] = "cmd_camera_config",
+	[FTHD_PROBE_CMD_CHANNEL_INFO] = "cmd_channel_info",
+	[FTHD_PROBE_CMD_SENSOR_CONFIG] = "cmd_sensor_config",
+	[FTHD_PROBE_CMD_SET_FILE] = "cmd_set_file",
+	[FTHD_PROBE_V4L2] = "v4l2",
+};
+
+/* Charge the time since the previous mark to phase */
+void fthd_probe_mark(struct fthd_private *dev_priv, enum fthd_probe_phase phase)
+{
+	ktime_t now;
+
+	if (!dev_priv->probe_stamp)
+		return;
+
+	now = ktime_get();
+	dev_priv->probe_ns[phase] += ktime_to_ns(ktime_sub(now, dev_priv->probe_stamp));
+	dev_priv->probe_stamp = now;
+}
+
+static void fthd_probe_report(struct fthd_private *dev_priv, ktime_t start)
+{
+	char buf[512];
+	int i, len = 0;
+
+	dev_priv->probe_total_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	dev_priv->probe_stamp = 0;
+
+	for (i = 0; i < FTHD_PROBE_PHASES; i++)
+		len += scnprintf(buf + len, sizeof(buf) - len, " %s=%llu",
+				 fthd_probe_phase_names[i],
+				 div_u64(dev_priv->probe_ns[i], NSEC_PER_USEC));
+
+	dev_info(&dev_priv->pdev->dev, "probe took %lluus:%s\n",
+		 div_u64(dev_priv->probe_total_ns, NSEC_PER_USEC), buf);
 }
 
 static int fthd_pci_probe(struct pci_dev *pdev,
 			  const struct pci_device_id *entry)
 {
 	struct fthd_private *dev_priv;
+	ktime_t start;
 	int ret;
 
+	start = ktime_get();
+
 	dev_info(&pdev->dev, "Found FaceTime HD camera with device id: %x\n",
 		 pdev->device);
 
@@ -465,24 +800,49 @@ static int fthd_pci_probe(struct pci_dev *pdev,
 
 	dev_priv->ddr_model = 4;
 	dev_priv->ddr_speed = 450;
-	dev_priv->frametime = 40; /* 25 fps */
+	dev_priv->fps = FTHD_SENSOR_MODE_FPS;
+	dev_priv->frametime = 1000 / dev_priv->fps;
+	dev_priv->min_fps = FTHD_MIN_FPS;
+	dev_priv->face_detection = 1;
+	dev_priv->face_detection_max = FTHD_ISP_MAX_FACES;
+	dev_priv->md_threshold = FTHD_MOTION_THRESHOLD;
+	dev_priv->fw_print = fw_print;
+	dev_priv->fw_debug_level = fw_debug_level;
+	dev_priv->multiplanar = multiplanar;
+	dev_priv->ddr_shmoo = ddr_shmoo;
+	/* Nothing to recover until the firmware is up */
+	dev_priv->recovery_disabled = 1;
 
 	spin_lock_init(&dev_priv->io_lock);
+	spin_lock_init(&dev_priv->cmd_stats_lock);
 	mutex_init(&dev_priv->vb2_queue_lock);
+	init_rwsem(&dev_priv->cmd_rwsem);
+	INIT_LIST_HEAD(&dev_priv->mem_orphans);
+	spin_lock_init(&dev_priv->mem_orphans_lock);
 
 	mutex_init(&dev_priv->ioctl_lock);
 	INIT_LIST_HEAD(&dev_priv->buffer_queue);
 	INIT_WORK(&dev_priv->irq_work, fthd_irq_work);
+	INIT_WORK(&dev_priv->t2h_poll_work, fthd_t2h_poll_work);
+	INIT_WORK(&dev_priv->recovery_work, fthd_recovery_work);
+	INIT_DELAYED_WORK(&dev_priv->watchdog_work, fthd_watchdog_work);
 
 	dev_priv->pdev = pdev;
+	dev_priv->probe_stamp = start;
+
+	ret = fthd_fwlog_init(dev_priv);
+	if (ret)
+		goto fail_work;
 
 	ret = fthd_pci_init(dev_priv);
 	if (ret)
 		goto fail_work;
+	fthd_probe_mark(dev_priv, FTHD_PROBE_PCI);
 
 	ret = fthd_buffer_init(dev_priv);
 	if (ret)
 		goto fail_pci;
+	fthd_probe_mark(dev_priv, FTHD_PROBE_BUFFER);
 
 	ret = fthd_hw_init(dev_priv);
 	if (ret)
@@ -495,12 +855,18 @@ static int fthd_pci_probe(struct pci_dev *pdev,
 	ret = fthd_v4l2_register(dev_priv);
 	if (ret)
 		goto fail_firmware;
+	fthd_probe_mark(dev_priv, FTHD_PROBE_V4L2);
 
 	ret = fthd_debugfs_init(dev_priv);
 	if (ret)
 		goto fail_v4l2;
+
+	fthd_probe_report(dev_priv, start);
+	dev_priv->recovery_disabled = 0;
 	return 0;
 fail_v4l2:
+	/* Nothing can be streaming before probe returns */
+	fthd_meta_unregister(dev_priv);
 	fthd_v4l2_unregister(dev_priv);
 fail_firmware:
 	fthd_stop_firmware(dev_priv);
@@ -517,7 +883,11 @@ fail_pci:
 	pci_disable_device(pdev);
 
 fail_work:
+	dev_priv->recovery_disabled = 1;
+	cancel_work_sync(&dev_priv->recovery_work);
 	cancel_work_sync(&dev_priv->irq_work);
+	cancel_work_sync(&dev_priv->t2h_poll_work);
+	fthd_fwlog_exit(dev_priv);
 	kfree(dev_priv);
 	return ret;
 }
@@ -14,6 +14,8 @@
 #include <linux/spinlock.h>
 #include <linux/wait.h>
 #include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/workqueue.h>
 #include <linux/version.h>
 #include <media/videobuf2-dma-sg.h>
 #include <media/v4l2-device.h>
@@ -47,6 +49,74 @@ struct fw_channel {
 	char *name;
 };
 
+struct fthd_fwlog;
+struct fthd_debug_result;
+struct fthd_profile;
+struct fthd_bench;
+
+#define FTHD_CMD_STATS_SLOTS	64
+#define FTHD_CMD_STATS_BUCKETS	24
+
+/* Round trip statistics for one firmware command opcode */
+struct fthd_cmd_stats {
+	int used;
+	u16 opcode;
+	u64 count;
+	u64 errors;	/* completed with a non-zero status */
+	u64 timeouts;
+	u64 total_ns;
+	u64 min_ns;
+	u64 max_ns;
+	/* Bucket 0 is < 1us, bucket n counts [2^(n-1), 2^n) us */
+	u32 hist[FTHD_CMD_STATS_BUCKETS];
+};
+
+/* Probe phases timed with fthd_probe_mark() */
+enum fthd_probe_phase {
+	FTHD_PROBE_PCI,
+	FTHD_PROBE_BUFFER,
+	FTHD_PROBE_DDR_INIT,
+	FTHD_PROBE_DDR_VERIFY,
+	FTHD_PROBE_FW_UPLOAD,
+	FTHD_PROBE_ISP_WAKE,
+	FTHD_PROBE_ISP_BOOT,
+	FTHD_PROBE_CMD_START,
+	FTHD_PROBE_CMD_PRINT,
+	FTHD_PROBE_CMD_DEBUG_LEVEL,
+	FTHD_PROBE_CMD_CAMERA_CONFIG,
+	FTHD_PROBE_CMD_CHANNEL_INFO,
+	FTHD_PROBE_CMD_SENSOR_CONFIG,
+	FTHD_PROBE_CMD_SET_FILE,
+	FTHD_PROBE_V4L2,
+	FTHD_PROBE_PHASES,
+};
+
+#define FTHD_MAX_SENSOR_MODES	8
+/* Where a preset keeps its frame rate is unknown, all run at this */
+#define FTHD_SENSOR_MODE_FPS	30
+/* Firmware frame rates are fixed point, fps * FTHD_FRAME_RATE_DEN */
+#define FTHD_FRAME_RATE_DEN	256
+/* Default floor for a variable frame rate */
+#define FTHD_MIN_FPS		15
+
+/* Motion detection and luma statistics sample once per cell of this grid */
+#define FTHD_LUMA_GRID_W	32
+#define FTHD_LUMA_GRID_H	18
+#define FTHD_LUMA_CELLS		(FTHD_LUMA_GRID_W * FTHD_LUMA_GRID_H)
+/* Luma change for a cell to count as moving */
+#define FTHD_MOTION_CELL_DELTA	24
+/* Default number of moving cells for a motion event */
+#define FTHD_MOTION_THRESHOLD	16
+
+/* One camera config (readout mode) as reported by CH_CAMERA_CONFIG_GET */
+struct fthd_sensor_mode {
+	int config;		/* index for CH_CAMERA_CONFIG_SELECT */
+	unsigned int in_width;	/* sensor readout */
+	unsigned int in_height;
+	unsigned int width;	/* readout, clamped to config 0 */
+	unsigned int height;
+};
+
 struct fthd_private {
 	struct pci_dev *pdev;
 	unsigned int dma_mask;
@@ -57,6 +127,8 @@ struct fthd_private {
 	int users;
 	/* lock for synchronizing with irq/workqueue */
 	spinlock_t io_lock;
+	/* ISP_IRQ_ENABLE as last written, 0 while disabled. Under io_lock */
+	u32 irq_enable;
 
 	/* Mapped PCI resources */
 	void __iomem *s2_io;
@@ -70,6 +142,33 @@ struct fthd_private {
 
 	struct work_struct irq_work;
 
+	/* BUF_T2H polling mode, see t2h_poll_budget */
+	struct work_struct t2h_poll_work;
+	atomic_t t2h_polling;
+
+	/* Firmware watchdog and in-place ISP recovery */
+	struct work_struct recovery_work;
+	struct delayed_work watchdog_work;
+	atomic_t recovering;
+	int recovery_disabled;
+	/*
+	 * Held for reading around firmware commands and exclusively while the
+	 * ISP is torn down and brought back up. isp_dead is set under it once
+	 * a recovery has failed and the channels are gone for good.
+	 */
+	struct rw_semaphore cmd_rwsem;
+	int isp_dead;
+	/* ISP memory the firmware may still write to after a timeout, freed
+	 * by isp_uninit() together with the heap it was carved from */
+	struct list_head mem_orphans;
+	spinlock_t mem_orphans_lock;
+	unsigned int watchdog_sequence;
+	unsigned int watchdog_stall_ms;
+	u32 recoveries;
+	u32 recovery_failures;
+	u64 recovery_last_ns;
+	u64 recovery_total_ns;
+
 	/* Hardware info */
 	u32 core_clk;
 	u32 ddr_model;
@@ -77,6 +176,11 @@ struct fthd_private {
 	u32 vdl_step_size;
 
 	u32 ddr_phy_regs[DDR_PHY_NUM_REG];
+	int ddr_phy_source;
+	/* Run the shmoo, it writes inferred PHY registers */
+	int ddr_shmoo;
+	u32 ddr_cache_sensor_id0;
+	u32 ddr_cache_sensor_id1;
 
 	/* Root resource for memory management */
 	struct resource *mem;
@@ -108,8 +212,12 @@ struct fthd_private {
 	 * (MacBook8,1, sensor 1675) reports 848x588. 0 until detected. */
 	unsigned int sensor_width;
 	unsigned int sensor_height;
+	struct fthd_sensor_mode sensor_modes[FTHD_MAX_SENSOR_MODES];
+	int num_sensor_modes;
 
 	struct fthd_fmt fmt;
+	/* Use the multi-planar API, only then NV16M is offered */
+	int multiplanar;
 
 	struct vb2_queue vb2_queue;
 	struct mutex vb2_queue_lock;
@@ -120,9 +228,56 @@ struct fthd_private {
 	struct h2t_buf_ctx h2t_bufs[FTHD_BUFFERS];
 
 	struct v4l2_ctrl_handler v4l2_ctrl_handler;
-	int frametime;
+	/* Set under the control handler lock while the channel runs, controls
+	 * only reach the firmware directly then */
+	int channel_started;
+	int frametime;		/* ms, follows fps */
+	unsigned int fps;	/* requested rate, programmed while streaming */
+	/* Let AE lower the rate down to min_fps for longer exposures */
+	int variable_fps;
+	unsigned int min_fps;
+	/* Firmware face detection, results are only dumped to the debug log */
+	int face_detection;
+	int face_detection_max;
+	/* V4L2_CID_DETECT_MD_*, and the luma grid of the previous frame */
+	int md_mode;
+	int md_threshold;
+	int motion_active;
+	int luma_grid_valid;
+	u8 luma_grid[FTHD_LUMA_CELLS];
+	/* Delivered rate: timestamp of the last frame and a running average
+	 * of the interval, reset on stream start */
+	u64 frame_last_ns;
+	u64 frame_interval_ns;
 	unsigned int sequence;
 	struct dentry *debugfs;
+	struct fthd_fwlog *fwlog;
+	struct fthd_meta *meta;
+	struct fthd_debug_result *debug_result;
+	struct fthd_profile *profile;
+	struct fthd_bench *bench;
+
+	/* Firmware print control, applied on every firmware start */
+	int fw_print;
+	int fw_debug_level;
+	u64 terminal_irqs_last;
+	ktime_t terminal_irqs_time;
+
+	/* Time spent in each probe phase, probe_stamp is 0 outside of probe */
+	ktime_t probe_stamp;
+	u64 probe_ns[FTHD_PROBE_PHASES];
+	u64 probe_total_ns;
+
+	/* Firmware command latency statistics */
+	spinlock_t cmd_stats_lock;
+	struct fthd_cmd_stats cmd_stats[FTHD_CMD_STATS_SLOTS];
 };
 
+extern void fthd_schedule_recovery(struct fthd_private *dev_priv);
+extern void fthd_watchdog_start(struct fthd_private *dev_priv);
+extern void fthd_watchdog_stop(struct fthd_private *dev_priv);
+extern const char * const fthd_probe_phase_names[FTHD_PROBE_PHASES];
+extern void fthd_probe_mark(struct fthd_private *dev_priv,
+			    enum fthd_probe_phase phase);
+
 #endif
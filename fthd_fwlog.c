@@ -0,0 +1,173 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * FacetimeHD camera driver
+ *
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>
+#include <linux/version.h>
+#include "fthd_drv.h"
+#include "fthd_hw.h"
+#include "fthd_fwlog.h"
+
+int fthd_fwlog_init(struct fthd_private *dev_priv)
+{
+	struct fthd_fwlog *log;
+
+	log = kzalloc(sizeof(*log), GFP_KERNEL);
+	if (!log)
+		return -ENOMEM;
+
+	log->vmem = vmalloc_user(PAGE_SIZE + FTHD_FWLOG_SIZE);
+	if (!log->vmem) {
+		kfree(log);
+		return -ENOMEM;
+	}
+
+	log->hdr = log->vmem;
+	log->data = log->vmem + PAGE_SIZE;
+	log->hdr->size = FTHD_FWLOG_SIZE;
+	init_waitqueue_head(&log->wq);
+	mutex_init(&log->read_lock);
+
+	dev_priv->fwlog = log;
+	return 0;
+}
+
+void fthd_fwlog_exit(struct fthd_private *dev_priv)
+{
+	struct fthd_fwlog *log = dev_priv->fwlog;
+
+	if (!log)
+		return;
+
+	dev_priv->fwlog = NULL;
+	vfree(log->vmem);
+	kfree(log);
+}
+
+/*
+ * Copy a firmware message from S2 memory into the ring. There is a single
+ * writer (the TERMINAL channel handler), so only the indices need ordering.
+ * Messages that don't fit are dropped whole.
+ */
+void fthd_fwlog_write(struct fthd_private *dev_priv, u32 address, u32 len)
+{
+	struct fthd_fwlog *log = dev_priv->fwlog;
+	u32 head, tail, off, part;
+
+	if (!log || !len)
+		return;
+
+	head = log->hdr->head;
+	tail = smp_load_acquire(&log->hdr->tail);
+
+	if (len > FTHD_FWLOG_SIZE - (head - tail)) {
+		log->hdr->dropped++;
+		return;
+	}
+
+	off = head & (FTHD_FWLOG_SIZE - 1);
+	part = min_t(u32, len, FTHD_FWLOG_SIZE - off);
+	FTHD_S2_MEMCPY_FROMIO(log->data + off, address, part);
+	if (part < len)
+		FTHD_S2_MEMCPY_FROMIO(log->data, address + part, len - part);
+
+	smp_store_release(&log->hdr->head, head + len);
+	wake_up_interruptible(&log->wq);
+}
+
+static int fthd_fwlog_open(struct inode *inode, struct file *file)
+{
+	file->private_data = inode->i_private;
+	return nonseekable_open(inode, file);
+}
+
+static ssize_t fthd_fwlog_read(struct file *file, char __user *user_buf,
+			       size_t count, loff_t *ppos)
+{
+	struct fthd_private *dev_priv = file->private_data;
+	struct fthd_fwlog *log = dev_priv->fwlog;
+	u32 head, tail, off, len, part;
+	int ret;
+
+	if (!count)
+		return 0;
+
+	ret = mutex_lock_interruptible(&log->read_lock);
+	if (ret)
+		return ret;
+
+	tail = log->hdr->tail;
+	while ((head = smp_load_acquire(&log->hdr->head)) == tail) {
+		mutex_unlock(&log->read_lock);
+
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		ret = wait_event_interruptible(log->wq,
+			smp_load_acquire(&log->hdr->head) != READ_ONCE(log->hdr->tail));
+		if (ret)
+			return ret;
+
+		ret = mutex_lock_interruptible(&log->read_lock);
+		if (ret)
+			return ret;
+		tail = log->hdr->tail;
+	}
+
+	len = min_t(u32, head - tail, count);
+	off = tail & (FTHD_FWLOG_SIZE - 1);
+	part = min_t(u32, len, FTHD_FWLOG_SIZE - off);
+
+	if (copy_to_user(user_buf, log->data + off, part) ||
+	    (part < len && copy_to_user(user_buf + part, log->data, len - part))) {
+		mutex_unlock(&log->read_lock);
+		return -EFAULT;
+	}
+
+	smp_store_release(&log->hdr->tail, tail + len);
+	mutex_unlock(&log->read_lock);
+	return len;
+}
+
+static __poll_t fthd_fwlog_poll(struct file *file, poll_table *wait)
+{
+	struct fthd_private *dev_priv = file->private_data;
+	struct fthd_fwlog *log = dev_priv->fwlog;
+
+	poll_wait(file, &log->wq, wait);
+
+	if (smp_load_acquire(&log->hdr->head) != READ_ONCE(log->hdr->tail))
+		return EPOLLIN | EPOLLRDNORM;
+	return 0;
+}
+
+static int fthd_fwlog_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fthd_private *dev_priv = file->private_data;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+	vm_flags_clear(vma, VM_MAYWRITE);
+#else
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+	return remap_vmalloc_range(vma, dev_priv->fwlog->vmem, vma->vm_pgoff);
+}
+
+const struct file_operations fthd_fwlog_fops = {
+	.owner = THIS_MODULE,
+	.open = fthd_fwlog_open,
+	.read = fthd_fwlog_read,
+	.poll = fthd_fwlog_poll,
+	.mmap = fthd_fwlog_mmap,
+};
@@ -0,0 +1,48 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * FacetimeHD camera driver
+ *
+ */
+
+#ifndef _FTHD_FWLOG_H
+#define _FTHD_FWLOG_H
+
+#include <linux/types.h>
+#include <linux/wait.h>
+#include <linux/mutex.h>
+#include <linux/fs.h>
+
+/* Must be a power of two */
+#define FTHD_FWLOG_SIZE (64 * 1024)
+
+/*
+ * First page of the mapping, followed by FTHD_FWLOG_SIZE bytes of log data.
+ * head and tail are free running byte counters, the data offset is the
+ * counter modulo size. Userspace mapping the buffer should treat it as
+ * read only and use read() to consume.
+ */
+struct fthd_fwlog_header {
+	u32 size;
+	u32 head;
+	u32 tail;
+	u32 reserved;
+	u64 dropped;
+};
+
+struct fthd_fwlog {
+	void *vmem;
+	struct fthd_fwlog_header *hdr;
+	char *data;
+	wait_queue_head_t wq;
+	/* Serializes readers, the writer never takes it */
+	struct mutex read_lock;
+};
+
+struct fthd_private;
+
+extern int fthd_fwlog_init(struct fthd_private *dev_priv);
+extern void fthd_fwlog_exit(struct fthd_private *dev_priv);
+extern void fthd_fwlog_write(struct fthd_private *dev_priv, u32 address, u32 len);
+extern const struct file_operations fthd_fwlog_fops;
+#endif
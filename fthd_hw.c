@@ -614,7 +614,7 @@ void fthd_ddr_phy_save_regs(struct fthd_private *dev_priv)
 	for (i = 0; i < DDR_PHY_NUM_REG; i++) {
 		offset = fthd_ddr_phy_reg_map[i];
 		dev_priv->ddr_phy_regs[i] =
-			FTHD_ISP_REG_READ(DDR_PHY_REG_BASE + offset);
+			FTHD_S2_REG_READ(DDR_PHY_REG_BASE + offset);
 	}
 }
 
@@ -632,15 +632,45 @@ void fthd_ddr_phy_restore_regs(struct fthd_private *dev_priv)
 
 int fthd_irq_enable(struct fthd_private *dev_priv)
 {
-	FTHD_ISP_REG_WRITE(0xf8, ISP_IRQ_ENABLE);
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev_priv->io_lock, flags);
+	dev_priv->irq_enable = 0xf8;
+	FTHD_ISP_REG_WRITE(dev_priv->irq_enable, ISP_IRQ_ENABLE);
+	spin_unlock_irqrestore(&dev_priv->io_lock, flags);
 	pci_write_config_dword(dev_priv->pdev, 0x94, 0x200);
 
 	return 0;
 }
 
+/*
+ * Mask or unmask the interrupt of a single channel source. Nothing is
+ * touched while interrupts are disabled as a whole, fthd_irq_enable()
+ * unmasks every source again.
+ */
+void fthd_irq_source_mask(struct fthd_private *dev_priv, int source, int masked)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev_priv->io_lock, flags);
+	if (dev_priv->irq_enable) {
+		if (masked)
+			dev_priv->irq_enable &= ~(0x10 << source);
+		else
+			dev_priv->irq_enable |= 0x10 << source;
+		FTHD_ISP_REG_WRITE(dev_priv->irq_enable, ISP_IRQ_ENABLE);
+	}
+	spin_unlock_irqrestore(&dev_priv->io_lock, flags);
+}
+
 int fthd_irq_disable(struct fthd_private *dev_priv)
 {
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev_priv->io_lock, flags);
+	dev_priv->irq_enable = 0;
 	FTHD_ISP_REG_WRITE(0, ISP_IRQ_ENABLE);
+	spin_unlock_irqrestore(&dev_priv->io_lock, flags);
 	pci_write_config_dword(dev_priv->pdev, 0x94, 0x0);
 
 	return 0;
@@ -656,6 +686,7 @@ int fthd_hw_init(struct fthd_private *dev_priv)
 
 	fthd_hw_s2_preinit_ddr_controller_soc(dev_priv);
 	fthd_hw_s2_init_ddr_controller_soc(dev_priv);
+	fthd_probe_mark(dev_priv, FTHD_PROBE_DDR_INIT);
 
 /*
 	dev_info(&dev_priv->pdev->dev,
@@ -671,20 +702,9 @@ int fthd_hw_init(struct fthd_private *dev_priv)
 	}
 */
 
-	ret = fthd_ddr_verify_mem(dev_priv, 0, MEM_VERIFY_NUM);
-	if (ret) {
-		dev_err(&dev_priv->pdev->dev,
-			"Full memory verification failed! (%d)\n", ret);
-		/*
-		 * Here we should do a shmoo calibration but it's not yet
-		 * fully implemented.
-		 */
-
-		/* fthd_ddr_calibrate(dev_priv); */
-	} else {
-		dev_info(&dev_priv->pdev->dev,
-			 "Full memory verification succeeded! (%d)\n", ret);
-	}
+	/* Failure is not fatal, we keep running on the default settings */
+	fthd_ddr_phy_init(dev_priv);
+	fthd_probe_mark(dev_priv, FTHD_PROBE_DDR_VERIFY);
 
 	/* Save our working configuration */
 	fthd_ddr_phy_save_regs(dev_priv);
@@ -697,6 +717,7 @@ int fthd_hw_init(struct fthd_private *dev_priv)
 	ret = isp_init(dev_priv);
 	if (ret)
 	    goto out;
+	fthd_probe_mark(dev_priv, FTHD_PROBE_ISP_BOOT);
 
 	dev_info(&dev_priv->pdev->dev, "Enabling interrupts\n");
 	fthd_irq_enable(dev_priv);
@@ -121,6 +121,7 @@ static inline void _FTHD_ISP_REG_WRITE(struct fthd_private *dev_priv, u32 val,
 
 extern int fthd_irq_enable(struct fthd_private *dev_priv);
 extern int fthd_irq_disable(struct fthd_private *dev_priv);
+extern void fthd_irq_source_mask(struct fthd_private *dev_priv, int source, int masked);
 extern int fthd_hw_init(struct fthd_private *dev_priv);
 extern void fthd_hw_deinit(struct fthd_private *priv);
 extern void fthd_ddr_phy_save_regs(struct fthd_private *dev_priv);
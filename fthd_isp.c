@@ -12,11 +12,15 @@
 #include <linux/acpi.h>
 #include <linux/firmware.h>
 #include <linux/dmi.h>
+#include <linux/ktime.h>
+#include <linux/sort.h>
+#include <linux/slab.h>
 #include "fthd_drv.h"
 #include "fthd_hw.h"
 #include "fthd_reg.h"
 #include "fthd_ringbuf.h"
 #include "fthd_isp.h"
+#include "fthd_meta.h"
 
 int isp_mem_init(struct fthd_private *dev_priv)
 {
@@ -81,6 +85,35 @@ int isp_mem_destroy(struct isp_mem_obj *obj)
 	return 0;
 }
 
+/*
+ * For memory handed to the firmware by a command that timed out. The
+ * firmware may still write to it, so it stays allocated until the ISP has
+ * been reset and isp_uninit() drops the whole heap.
+ */
+static void isp_mem_orphan(struct fthd_private *dev_priv, struct isp_mem_obj *obj)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev_priv->mem_orphans_lock, flags);
+	list_add_tail(&obj->orphan, &dev_priv->mem_orphans);
+	spin_unlock_irqrestore(&dev_priv->mem_orphans_lock, flags);
+}
+
+static void isp_mem_free_orphans(struct fthd_private *dev_priv)
+{
+	struct isp_mem_obj *obj, *tmp;
+	unsigned long flags;
+	LIST_HEAD(orphans);
+
+	spin_lock_irqsave(&dev_priv->mem_orphans_lock, flags);
+	list_splice_init(&dev_priv->mem_orphans, &orphans);
+	spin_unlock_irqrestore(&dev_priv->mem_orphans_lock, flags);
+
+	/* The resources went away with the heap, only the wrappers are left */
+	list_for_each_entry_safe(obj, tmp, &orphans, orphan)
+		kfree(obj);
+}
+
 static int isp_acpi_set_power(struct fthd_private *dev_priv, int power)
 {
 	acpi_status status;
@@ -263,13 +296,63 @@ out:
 	return -ENOMEM;
 }
 
-static int fthd_isp_cmd(struct fthd_private *dev_priv, enum fthd_isp_cmds command, void *buf,
-			int request_len, int *response_len)
+static void fthd_isp_cmd_account(struct fthd_private *dev_priv, u16 opcode,
+				 u64 ns, int timeout, int status)
+{
+	struct fthd_cmd_stats *stats = NULL;
+	unsigned long flags;
+	u64 us;
+	int i, bucket;
+
+	spin_lock_irqsave(&dev_priv->cmd_stats_lock, flags);
+	for (i = 0; i < FTHD_CMD_STATS_SLOTS; i++) {
+		if (!dev_priv->cmd_stats[i].used) {
+			stats = dev_priv->cmd_stats + i;
+			stats->used = 1;
+			stats->opcode = opcode;
+			break;
+		}
+		if (dev_priv->cmd_stats[i].opcode == opcode) {
+			stats = dev_priv->cmd_stats + i;
+			break;
+		}
+	}
+
+	if (!stats)
+		goto out;
+
+	if (timeout) {
+		stats->timeouts++;
+		goto out;
+	}
+
+	if (status)
+		stats->errors++;
+
+	if (!stats->count || ns < stats->min_ns)
+		stats->min_ns = ns;
+	if (ns > stats->max_ns)
+		stats->max_ns = ns;
+	stats->count++;
+	stats->total_ns += ns;
+
+	us = div_u64(ns, NSEC_PER_USEC);
+	bucket = us ? fls64(us) : 0;
+	if (bucket >= FTHD_CMD_STATS_BUCKETS)
+		bucket = FTHD_CMD_STATS_BUCKETS - 1;
+	stats->hist[bucket]++;
+out:
+	spin_unlock_irqrestore(&dev_priv->cmd_stats_lock, flags);
+}
+
+static int __fthd_isp_cmd(struct fthd_private *dev_priv, enum fthd_isp_cmds command, void *buf,
+			  int request_len, int *response_len)
 {
 	struct isp_mem_obj *request;
 	struct isp_cmd_hdr cmd;
 	u32 address, request_size, response_size;
 	u32 entry;
+	ktime_t start;
 	int len, ret;
 
 	memset(&cmd, 0, sizeof(cmd));
@@ -295,6 +378,7 @@ static int fthd_isp_cmd(struct fthd_private *dev_priv, enum fthd_isp_cmds comman
 	if (request_len)
 		FTHD_S2_MEMCPY_TOIO(request->offset + sizeof(struct isp_cmd_hdr), buf, request_len);
 
+	start = ktime_get();
 	ret = fthd_channel_ringbuf_send(dev_priv, dev_priv->channel_io,
 					  request->offset, request_len + 8, (response_len ? *response_len : 0) + 8, &entry);
 	if (ret)
@@ -313,6 +397,13 @@ static int fthd_isp_cmd(struct fthd_private *dev_priv, enum fthd_isp_cmds comman
 
         ret = fthd_channel_wait_ready(dev_priv, dev_priv->channel_io, entry, 2000);
 	if (ret) {
+		/* Interrupted or not, the firmware still owns the request */
+		isp_mem_orphan(dev_priv, request);
+		request = NULL;
+		if (ret == -ETIMEDOUT) {
+			fthd_isp_cmd_account(dev_priv, command, 0, 1, 0);
+			fthd_schedule_recovery(dev_priv);
+		}
 		if (response_len)
 			*response_len = 0;
 		goto out;
@@ -332,14 +423,33 @@ static int fthd_isp_cmd(struct fthd_private *dev_priv, enum fthd_isp_cmds comman
 	pr_debug("status %04x, request_len %d response len %d address_flags %x\n", cmd.status,
 		request_size, response_size, address);
 
+	fthd_isp_cmd_account(dev_priv, command, ktime_to_ns(ktime_sub(ktime_get(), start)),
+			     0, cmd.status);
+
 	ret = cmd.status ? -EIO : 0;
 out:
 	isp_mem_destroy(request);
 	return ret;
 }
 
-int fthd_isp_debug_cmd(struct fthd_private *dev_priv, enum fthd_isp_cmds command, void *buf,
+/*
+ * The channels go away while the ISP is reset, so commands hold cmd_rwsem
+ * for reading. Once a reset has failed there is no firmware to talk to.
+ */
+static int fthd_isp_cmd(struct fthd_private *dev_priv, enum fthd_isp_cmds command, void *buf,
 			int request_len, int *response_len)
+{
+	int ret = -ENODEV;
+
+	down_read(&dev_priv->cmd_rwsem);
+	if (!dev_priv->isp_dead)
+		ret = __fthd_isp_cmd(dev_priv, command, buf, request_len, response_len);
+	up_read(&dev_priv->cmd_rwsem);
+	return ret;
+}
+
+static int __fthd_isp_debug_cmd(struct fthd_private *dev_priv, enum fthd_isp_cmds command,
+				void *buf, int request_len, int *response_len)
 {
 	struct isp_mem_obj *request;
 	struct isp_cmd_hdr cmd;
@@ -382,6 +492,8 @@ int fthd_isp_debug_cmd(struct fthd_private *dev_priv, enum fthd_isp_cmds command
 
         ret = fthd_channel_wait_ready(dev_priv, dev_priv->channel_debug, entry, 20000);
 	if (ret) {
+		isp_mem_orphan(dev_priv, request);
+		request = NULL;
 		if (response_len)
 			*response_len = 0;
 		goto out;
@@ -398,16 +510,26 @@ int fthd_isp_debug_cmd(struct fthd_private *dev_priv, enum fthd_isp_cmds command
 		FTHD_S2_MEMCPY_FROMIO(buf, (address & ~3) + sizeof(struct isp_cmd_hdr),
 				     *response_len);
 
-	pr_info("status %04x, request_len %d response len %d address_flags %x\n", cmd.status,
+	pr_debug("status %04x, request_len %d response len %d address_flags %x\n", cmd.status,
 		request_size, response_size, address);
 
-	ret = 0;
+	ret = cmd.status ? -EIO : 0;
 out:
 	isp_mem_destroy(request);
 	return ret;
 }
 
+int fthd_isp_debug_cmd(struct fthd_private *dev_priv, enum fthd_isp_cmds command, void *buf,
+			int request_len, int *response_len)
+{
+	int ret = -ENODEV;
 
+	down_read(&dev_priv->cmd_rwsem);
+	if (!dev_priv->isp_dead)
+		ret = __fthd_isp_debug_cmd(dev_priv, command, buf, request_len, response_len);
+	up_read(&dev_priv->cmd_rwsem);
+	return ret;
+}
 
 int fthd_isp_cmd_start(struct fthd_private *dev_priv)
 {
@@ -501,6 +623,7 @@ int isp_uninit(struct fthd_private *dev_priv)
 	isp_free_set_file(dev_priv);
 	isp_mem_destroy(dev_priv->firmware);
 	kfree(dev_priv->mem);
+	isp_mem_free_orphans(dev_priv);
 	return 0;
 }
 
@@ -514,6 +637,173 @@ int fthd_isp_cmd_print_enable(struct fthd_private *dev_priv, int enable)
 	return fthd_isp_cmd(dev_priv, CISP_CMD_PRINT_ENABLE, &cmd, sizeof(cmd), NULL);
 }
 
+static int fthd_isp_ping_cmp(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Round trip benchmark. Keeps up to depth commands in flight on the IO or
+ * DEBUG channel and times each one from ring submission until the firmware
+ * hands the entry back. The IO channel has no NOP, so a CONFIG_GET is used
+ * there, the DEBUG channel uses CISP_CMD_DEBUG_NOP1.
+ */
+static int __fthd_isp_ping(struct fthd_private *dev_priv, struct fw_channel *chan,
+			   int count, int depth, struct fthd_ping_result *res)
+{
+	struct isp_mem_obj *req[FTHD_PING_MAX_DEPTH] = { NULL };
+	u32 entry[FTHD_PING_MAX_DEPTH];
+	ktime_t start[FTHD_PING_MAX_DEPTH], begin;
+	struct isp_cmd_hdr cmd;
+	u64 *samples;
+	int sent = 0, done = 0, slot, ret = 0, err, len, i;
+
+	if (chan == dev_priv->channel_io) {
+		cmd.opcode = CISP_CMD_CONFIG_GET;
+		len = sizeof(struct isp_cmd_config);
+	} else if (chan == dev_priv->channel_debug) {
+		cmd.opcode = CISP_CMD_DEBUG_NOP1;
+		len = 0;
+	} else {
+		return -EINVAL;
+	}
+
+	if (count < 1 || count > FTHD_PING_MAX_COUNT)
+		return -EINVAL;
+
+	memset(res, 0, sizeof(*res));
+	depth = clamp(depth, 1, min_t(int, chan->size - 1, FTHD_PING_MAX_DEPTH));
+
+	samples = kvmalloc_array(count, sizeof(*samples), GFP_KERNEL);
+	if (!samples)
+		return -ENOMEM;
+
+	for (i = 0; i < depth; i++) {
+		req[i] = isp_mem_create(dev_priv, FTHD_MEM_CMD, sizeof(cmd) + len);
+		if (!req[i]) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	cmd.unknown0 = 0;
+	begin = ktime_get();
+
+	while (done < count) {
+		while (sent < count && sent - done < depth) {
+			slot = sent % depth;
+			cmd.status = 0;
+			FTHD_S2_MEMCPY_TOIO(req[slot]->offset, &cmd, sizeof(cmd));
+			start[slot] = ktime_get();
+			ret = fthd_channel_ringbuf_send(dev_priv, chan, req[slot]->offset,
+							len + 8, len + 8, &entry[slot]);
+			if (ret)
+				goto out;
+			sent++;
+		}
+
+		slot = done % depth;
+		ret = fthd_channel_wait_ready(dev_priv, chan, entry[slot], 2000);
+		if (ret)
+			goto out;
+
+		samples[done++] = ktime_to_ns(ktime_sub(ktime_get(), start[slot]));
+		/* Status is the upper half of the opcode word */
+		if (FTHD_S2_MEM_READ(req[slot]->offset + offsetof(struct isp_cmd_hdr, opcode)) >> 16)
+			res->errors++;
+	}
+
+	res->total_ns = ktime_to_ns(ktime_sub(ktime_get(), begin));
+	sort(samples, count, sizeof(*samples), fthd_isp_ping_cmp, NULL);
+	res->count = count;
+	res->depth = depth;
+	res->min_ns = samples[0];
+	res->median_ns = samples[count / 2];
+	res->p99_ns = samples[min_t(size_t, count - 1, (size_t)count * 99 / 100)];
+	res->valid = 1;
+out:
+	/* Let the firmware hand back what is still in flight before freeing */
+	while (ret != -ETIMEDOUT && ret != -ERESTARTSYS && done < sent) {
+		slot = done % depth;
+		err = fthd_channel_wait_ready(dev_priv, chan, entry[slot], 2000);
+		if (err)
+			ret = err;
+		else
+			done++;
+	}
+
+	/* The firmware still owns these, they are freed after the next reset */
+	for (; done < sent; done++) {
+		slot = done % depth;
+		isp_mem_orphan(dev_priv, req[slot]);
+		req[slot] = NULL;
+	}
+	if (ret == -ETIMEDOUT)
+		fthd_schedule_recovery(dev_priv);
+
+	for (i = 0; i < depth; i++)
+		isp_mem_destroy(req[i]);
+	kvfree(samples);
+	return ret;
+}
+
+int fthd_isp_ping(struct fthd_private *dev_priv, struct fw_channel *chan,
+		  int count, int depth, struct fthd_ping_result *res)
+{
+	int ret = -ENODEV;
+
+	/* chan is only compared against the live channels under the lock */
+	down_read(&dev_priv->cmd_rwsem);
+	if (!dev_priv->isp_dead)
+		ret = __fthd_isp_ping(dev_priv, chan, count, depth, res);
+	up_read(&dev_priv->cmd_rwsem);
+	return ret;
+}
+
+int fthd_isp_cmd_timeprofile_start(struct fthd_private *dev_priv)
+{
+	return fthd_isp_cmd(dev_priv, CISP_CMD_TIMEPROFILE_START, NULL, 0, NULL);
+}
+
+int fthd_isp_cmd_timeprofile_stop(struct fthd_private *dev_priv)
+{
+	return fthd_isp_cmd(dev_priv, CISP_CMD_TIMEPROFILE_STOP, NULL, 0, NULL);
+}
+
+int fthd_isp_cmd_timeprofile_show(struct fthd_private *dev_priv,
+				  struct isp_cmd_timeprofile_show *show)
+{
+	int len, ret;
+
+	memset(show, 0, sizeof(*show));
+	len = sizeof(*show);
+	return fthd_isp_cmd(dev_priv, CISP_CMD_TIMEPROFILE_SHOW, show, 0, &len);
+}
+
+/*
+ * Set the debug level of every firmware object. The root handle is returned
+ * in the first argument word of the GET_ROOT_HANDLE response.
+ */
+int fthd_isp_set_debug_level(struct fthd_private *dev_priv, int level)
+{
+	struct fthd_isp_debug_cmd cmd;
+	int ret, len;
+
+	memset(&cmd, 0, sizeof(cmd));
+	len = sizeof(cmd);
+	ret = fthd_isp_debug_cmd(dev_priv, CISP_CMD_DEBUG_GET_ROOT_HANDLE, &cmd,
+				 sizeof(cmd), &len);
+	if (ret)
+		return ret;
+
+	cmd.show_errors = 1;
+	cmd.arg[1] = level;
+	return fthd_isp_debug_cmd(dev_priv, CISP_CMD_DEBUG_SET_DEBUG_LEVEL_RECURSIVE,
+				  &cmd, sizeof(cmd), NULL);
+}
+
 int fthd_isp_cmd_set_loadfile(struct fthd_private *dev_priv)
 {
 	struct isp_cmd_set_loadfile cmd;
@@ -648,12 +938,14 @@ int fthd_isp_cmd_camera_config(struct fthd_private *dev_priv)
 int fthd_isp_cmd_channel_camera_config(struct fthd_private *dev_priv)
 {
 	struct isp_cmd_channel_camera_config cmd;
-	int ret, len, i;
+	struct fthd_sensor_mode *mode;
+	int ret = 0, len, i, n = 0;
 	char prefix[16];
 	pr_debug("sending ch camera config\n");
 
 	memset(&cmd, 0, sizeof(cmd));
 	for(i = 0; i < dev_priv->sensor_count; i++) {
+		/* This selects the config (preset), not a sensor channel */
 		cmd.channel = i;
 
 		len = sizeof(cmd);
@@ -663,22 +955,45 @@ int fthd_isp_cmd_channel_camera_config(struct fthd_private *dev_priv)
 		snprintf(prefix, sizeof(prefix)-1, "CAMCONF%d ", i);
 		print_hex_dump_bytes(prefix, DUMP_PREFIX_OFFSET, &cmd, sizeof(cmd));
 
-		/* The first two u16s of the config payload are the sensor's
-		 * native width and height (e.g. 1280x720 on MacBookPro,
-		 * 848x588 on the 12-inch MacBook). Record sensor 0's size so
-		 * the V4L2 layer can advertise the real resolution instead of
-		 * a hardcoded one. */
+		if (n >= FTHD_MAX_SENSOR_MODES)
+			continue;
+
+		/* The payload starts with the readout width and height
+		 * (e.g. 1280x720 on MacBookPro, 848x588 on the 12-inch
+		 * MacBook). The next two u16s look like the size handed to
+		 * the ISP, but that is unverified and only logged. Config 0's
+		 * size bounds every mode, so a misread preset can't widen the
+		 * crop beyond the real readout. Where the frame rate is kept
+		 * is unknown too, so modes are only told apart by size. */
+		mode = &dev_priv->sensor_modes[n];
+		mode->in_width = cmd.data[0] | (cmd.data[1] << 8);
+		mode->in_height = cmd.data[2] | (cmd.data[3] << 8);
+
+		if (!mode->in_width || !mode->in_height)
+			continue;
+
 		if (i == 0) {
-			unsigned int w = cmd.data[0] | (cmd.data[1] << 8);
-			unsigned int h = cmd.data[2] | (cmd.data[3] << 8);
-
-			if (w && h) {
-				dev_priv->sensor_width = w;
-				dev_priv->sensor_height = h;
-				pr_debug("sensor native resolution: %ux%u\n", w, h);
-			}
+			dev_priv->sensor_width = mode->in_width;
+			dev_priv->sensor_height = mode->in_height;
+			pr_debug("sensor native resolution: %ux%u\n",
+				 mode->in_width, mode->in_height);
+		} else if (!dev_priv->sensor_width) {
+			continue;
 		}
+
+		mode->width = min(mode->in_width, dev_priv->sensor_width);
+		mode->height = min(mode->in_height, dev_priv->sensor_height);
+
+		pr_debug("sensor mode %d: %ux%u (unverified isp size %ux%u)\n", i,
+			 mode->in_width, mode->in_height,
+			 cmd.data[4] | (cmd.data[5] << 8),
+			 cmd.data[6] | (cmd.data[7] << 8));
+
+		mode->config = i;
+		n++;
 	}
+
+	dev_priv->num_sensor_modes = n;
 	return ret;
 }
 
@@ -707,7 +1022,7 @@ int fthd_isp_cmd_channel_crop_set(struct fthd_private *dev_priv, int channel,
 	memset(&cmd, 0, sizeof(cmd));
 	cmd.channel = channel;
 	cmd.x1 = x1;
-	cmd.y2 = y2;
+	cmd.y1 = y1;
 	cmd.x2 = x2;
 	cmd.y2 = y2;
 	len = sizeof(cmd);
@@ -878,6 +1193,46 @@ int fthd_isp_cmd_channel_frame_rate_max(struct fthd_private *dev_priv, int chann
 	return fthd_isp_cmd(dev_priv, CISP_CMD_CH_AE_FRAME_RATE_MAX_SET, &cmd, sizeof(cmd), &len);
 }
 
+int fthd_isp_cmd_channel_sensor_frame_rate(struct fthd_private *dev_priv, int channel, int rate)
+{
+	struct isp_cmd_channel_frame_rate_set cmd;
+	int len;
+
+	pr_debug("set sensor frame rate %d\n", rate);
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.channel = channel;
+	cmd.rate = rate;
+	len = sizeof(cmd);
+	return fthd_isp_cmd(dev_priv, CISP_CMD_CH_SENSOR_FRAME_RATE_SET, &cmd, sizeof(cmd), &len);
+}
+
+/*
+ * Program dev_priv->fps into the sensor and as the AE upper limit. With a
+ * constant rate the lower limit is pinned to it as well, so AE doesn't
+ * stretch the exposure and drop frames; with a variable rate AE may go
+ * down to min_fps in low light. Safe while streaming.
+ */
+int fthd_isp_set_frame_rate(struct fthd_private *dev_priv, int channel)
+{
+	int rate = dev_priv->fps * FTHD_FRAME_RATE_DEN;
+	int min_rate = rate;
+	int ret;
+
+	if (dev_priv->variable_fps)
+		min_rate = min(dev_priv->min_fps, dev_priv->fps) * FTHD_FRAME_RATE_DEN;
+
+	/* Older firmware may not know the command, AE still limits the rate */
+	ret = fthd_isp_cmd_channel_sensor_frame_rate(dev_priv, channel, rate);
+	if (ret)
+		pr_debug("sensor frame rate not set: %d\n", ret);
+
+	ret = fthd_isp_cmd_channel_frame_rate_max(dev_priv, channel, rate);
+	if (ret)
+		return ret;
+	return fthd_isp_cmd_channel_frame_rate_min(dev_priv, channel, min_rate);
+}
+
 int fthd_isp_cmd_channel_ae_speed_set(struct fthd_private *dev_priv, int channel, int speed)
 {
 	struct isp_cmd_channel_ae_speed_set cmd;
@@ -972,6 +1327,88 @@ int fthd_isp_cmd_channel_face_detection_disable(struct fthd_private *dev_priv, i
 	return fthd_isp_cmd(dev_priv, CISP_CMD_CH_FACE_DETECTION_DISABLE, &cmd, sizeof(cmd), &len);
 }
 
+int fthd_isp_cmd_channel_face_detection_config(struct fthd_private *dev_priv, int channel, int max_faces)
+{
+	struct isp_cmd_channel_face_detection_config cmd;
+	int len;
+
+	pr_debug("face detection max faces %d\n", max_faces);
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.channel = channel;
+	cmd.max_faces = max_faces;
+	len = sizeof(cmd);
+	return fthd_isp_cmd(dev_priv, CISP_CMD_CH_FACE_DETECTION_CONFIG_SET, &cmd, sizeof(cmd), &len);
+}
+
+/* Turn face detection on or off, also while streaming */
+int fthd_isp_face_detection(struct fthd_private *dev_priv, int channel, int enable)
+{
+	int ret;
+
+	if (!enable) {
+		ret = fthd_isp_cmd_channel_face_detection_stop(dev_priv, channel);
+		if (ret)
+			return ret;
+		return fthd_isp_cmd_channel_face_detection_disable(dev_priv, channel);
+	}
+
+	/* The limit is a hint, detection works without it */
+	ret = fthd_isp_cmd_channel_face_detection_config(dev_priv, channel,
+							 dev_priv->face_detection_max);
+	if (ret)
+		pr_debug("face detection config not set: %d\n", ret);
+
+	ret = fthd_isp_cmd_channel_face_detection_enable(dev_priv, channel);
+	if (ret)
+		return ret;
+	return fthd_isp_cmd_channel_face_detection_start(dev_priv, channel);
+}
+
+/* Caps how much of a face detection message is dumped */
+#define FTHD_ISP_FACE_DUMP_MAX	256
+
+static void fthd_isp_face_detection_result(struct fthd_private *dev_priv,
+					   u32 opcode, u32 address, u32 size)
+{
+	u8 buf[FTHD_ISP_FACE_DUMP_MAX];
+	u32 len = min_t(u32, size, sizeof(buf));
+
+	/* The layout isn't known yet, dump it for decoding offline rather
+	 * than publishing guessed rectangles */
+	FTHD_S2_MEMCPY_FROMIO(buf, address, len);
+	pr_debug("face detection message 0x%04x, %u bytes\n", opcode, size);
+	print_hex_dump_debug("FACES ", DUMP_PREFIX_OFFSET, 16, 1, buf, len, false);
+}
+
+/*
+ * Unsolicited messages from the firmware on IO_T2H. They start with the
+ * same header as commands; face detection results are dumped, the rest
+ * only logged.
+ */
+void fthd_isp_notify_handler(struct fthd_private *dev_priv, u32 address, u32 size)
+{
+	struct isp_cmd_hdr hdr;
+
+	if (size < sizeof(hdr))
+		return;
+
+	FTHD_S2_MEMCPY_FROMIO(&hdr, address, sizeof(hdr));
+	address += sizeof(hdr);
+	size -= sizeof(hdr);
+
+	switch (hdr.opcode) {
+	case CISP_CMD_CH_FACE_DETECTION_START ... CISP_CMD_CH_FACE_DETECTION_WINDOW_PARAM_GET:
+		if (dev_priv->face_detection)
+			fthd_isp_face_detection_result(dev_priv, hdr.opcode,
+						       address, size);
+		break;
+	default:
+		pr_debug("firmware notification 0x%04x, %u bytes\n", hdr.opcode, size);
+		break;
+	}
+}
+
 int fthd_isp_cmd_channel_temporal_filter_start(struct fthd_private *dev_priv, int channel)
 {
 	struct isp_cmd_channel_temporal_filter_start cmd;
@@ -1134,26 +1571,63 @@ int fthd_isp_cmd_channel_awb(struct fthd_private *dev_priv, int channel, int ena
 	return fthd_isp_cmd(dev_priv, op, &cmd, sizeof(cmd), &len);
 }
 
+int fthd_isp_cmd_channel_ae_param_get(struct fthd_private *dev_priv, int channel,
+				      u32 *integration_time, u32 *gain)
+{
+	struct isp_cmd_channel_ae_param cmd;
+	int ret, len;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.channel = channel;
+	len = sizeof(cmd);
+	ret = fthd_isp_cmd(dev_priv, CISP_CMD_CH_AE_PARAM_GET, &cmd, sizeof(cmd), &len);
+	if (ret)
+		return ret;
+	if (len < offsetofend(struct isp_cmd_channel_ae_param, gain))
+		return -EIO;
+
+	*integration_time = cmd.integration_time;
+	*gain = cmd.gain;
+	return 0;
+}
+
+int fthd_isp_cmd_channel_awb_cct_get(struct fthd_private *dev_priv, int channel, u32 *cct)
+{
+	struct isp_cmd_channel_awb_cct cmd;
+	int ret, len;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.channel = channel;
+	len = sizeof(cmd);
+	ret = fthd_isp_cmd(dev_priv, CISP_CMD_APPLE_CH_AWB_CCT_GET, &cmd, sizeof(cmd), &len);
+	if (ret)
+		return ret;
+	if (len < offsetofend(struct isp_cmd_channel_awb_cct, cct))
+		return -EIO;
+
+	*cct = cmd.cct;
+	return 0;
+}
+
 int fthd_start_channel(struct fthd_private *dev_priv, int channel)
 {
-	int ret, x1 = 0, x2 = 0, pixelformat;
+	int ret, pixelformat;
 
 	ret = fthd_isp_cmd_channel_camera_config(dev_priv);
 	if (ret)
 		return ret;
-	ret = fthd_isp_cmd_channel_camera_config_select(dev_priv, 0, 0);
+	ret = fthd_isp_cmd_channel_camera_config_select(dev_priv, 0,
+							dev_priv->fmt.config);
 	if (ret)
 		return ret;
 
-	/* Crop the full sensor area. The 12-inch MacBook (MacBook8,1, sensor
-	 * 1675) reports an 848x588 sensor via CISP_CMD_CH_CAMERA_CONFIG_GET;
-	 * the old hardcoded 1280x720 crop exceeds that array and makes the
-	 * sensor interface throw SIF errors. Use the negotiated format size. */
-	x1 = 0;
-	x2 = dev_priv->fmt.fmt.width;
-
-	ret = fthd_isp_cmd_channel_crop_set(dev_priv, 0, x1, 0, x2,
-					    dev_priv->fmt.fmt.height);
+	/* The crop window never exceeds the sensor area reported via
+	 * CISP_CMD_CH_CAMERA_CONFIG_GET (848x588 on the 12-inch MacBook);
+	 * anything larger makes the sensor interface throw SIF errors. The
+	 * ISP scales the window to the output size set below. */
+	ret = fthd_isp_cmd_channel_crop_set(dev_priv, 0,
+					    dev_priv->fmt.x1, dev_priv->fmt.y1,
+					    dev_priv->fmt.x2, dev_priv->fmt.y2);
 	if (ret)
 		return ret;
 
@@ -1165,6 +1639,7 @@ int fthd_start_channel(struct fthd_private *dev_priv, int channel)
 		pixelformat = 2;
 		break;
 	case V4L2_PIX_FMT_NV16:
+	case V4L2_PIX_FMT_NV16M:
 		pixelformat = 0;
 		break;
 	default:
@@ -1208,16 +1683,12 @@ int fthd_start_channel(struct fthd_private *dev_priv, int channel)
 	ret = fthd_isp_cmd_channel_error_handling_config(dev_priv, 0, 2, 1);
 	if (ret)
 		return ret;
-	ret = fthd_isp_cmd_channel_face_detection_enable(dev_priv, 0);
-	if (ret)
-		return ret;
-	ret = fthd_isp_cmd_channel_face_detection_start(dev_priv, 0);
-	if (ret)
-		return ret;
-	ret = fthd_isp_cmd_channel_frame_rate_max(dev_priv, 0, dev_priv->frametime * 256);
-	if (ret)
-		return ret;
-	ret = fthd_isp_cmd_channel_frame_rate_min(dev_priv, 0, dev_priv->frametime * 256);
+	if (dev_priv->face_detection) {
+		ret = fthd_isp_face_detection(dev_priv, 0, 1);
+		if (ret)
+			return ret;
+	}
+	ret = fthd_isp_set_frame_rate(dev_priv, 0);
 	if (ret)
 		return ret;
 	ret = fthd_isp_cmd_channel_temporal_filter_start(dev_priv, 0);
@@ -1290,6 +1761,7 @@ int isp_init(struct fthd_private *dev_priv)
 	ret = isp_load_firmware(dev_priv);
 	if (ret)
 		return ret;
+	fthd_probe_mark(dev_priv, FTHD_PROBE_FW_UPLOAD);
 
 	pci_set_power_state(dev_priv->pdev, PCI_D0);
 	mdelay(10);
@@ -1332,6 +1804,7 @@ int isp_init(struct fthd_private *dev_priv)
 
 	dev_info(&dev_priv->pdev->dev, "ISP woke up after %dms\n",
 		 (retries - 1) * 10);
+	fthd_probe_mark(dev_priv, FTHD_PROBE_ISP_WAKE);
 
 	FTHD_ISP_REG_WRITE(0xffffffff, ISP_IRQ_CLEAR);
 
@@ -474,6 +474,7 @@ struct isp_mem_obj {
 	resource_size_t size;
 	resource_size_t size_aligned;
 	unsigned long offset;
+	struct list_head orphan;	/* on dev_priv->mem_orphans */
 };
 
 struct isp_fw_args {
@@ -500,6 +501,40 @@ struct isp_cmd_print_enable {
 	u32 enable;
 } __attribute__((packed));
 
+#define ISP_TIMEPROFILE_STAGES 32
+
+/*
+ * CISP_CMD_TIMEPROFILE_SHOW response. The layout is inferred, not confirmed,
+ * so users print the raw words next to it. Times in firmware timer ticks.
+ */
+struct isp_timeprofile_stage {
+	u32 id;
+	u32 count;
+	u32 total;
+	u32 min;
+	u32 max;
+} __attribute__((packed));
+
+struct isp_cmd_timeprofile_show {
+	u32 num_stages;
+	struct isp_timeprofile_stage stage[ISP_TIMEPROFILE_STAGES];
+} __attribute__((packed));
+
+#define FTHD_PING_MAX_DEPTH 16
+/* Bounds the sample buffer and how long a run can hold off a recovery */
+#define FTHD_PING_MAX_COUNT 100000
+
+struct fthd_ping_result {
+	int valid;
+	int count;
+	int depth;
+	int errors;		/* commands completed with a non-zero status */
+	u64 min_ns;
+	u64 median_ns;
+	u64 p99_ns;
+	u64 total_ns;
+};
+
 struct isp_cmd_config {
 	u32 field0;
 	u32 field4;
@@ -635,6 +670,20 @@ struct isp_cmd_channel_face_detection_disable {
 	u32 channel;
 };
 
+/* Layout inferred, only the face limit is set */
+struct isp_cmd_channel_face_detection_config {
+	u32 channel;
+	u32 max_faces;
+};
+
+/*
+ * Face detection results are pushed by the firmware on IO_T2H, after an
+ * isp_cmd_hdr carrying a face detection opcode. Their layout is unknown,
+ * so they are only dumped to the debug log. The max faces limit matches
+ * what CH_FACE_DETECTION_CONFIG_SET is given.
+ */
+#define FTHD_ISP_MAX_FACES	8
+
 struct isp_cmd_channel_temporal_filter_start {
 	u32 channel;
 };
@@ -692,6 +741,24 @@ struct isp_cmd_channel_hue_set {
 	u32 contrast;
 };
 
+/*
+ * Response of CISP_CMD_CH_AE_PARAM_GET. Only the leading words are used,
+ * their meaning is inferred from CH_AE_INTEGRATION_GAIN_SET: the current
+ * integration time in us and the total gain in 8.8 fixed point.
+ */
+struct isp_cmd_channel_ae_param {
+	u32 channel;
+	u32 integration_time;
+	u32 gain;
+	u32 unknown[5];
+};
+
+/* Response of CISP_CMD_APPLE_CH_AWB_CCT_GET */
+struct isp_cmd_channel_awb_cct {
+	u32 channel;
+	u32 cct;
+};
+
 struct isp_cmd_channel {
 	u32 channel;
 };
@@ -706,6 +773,22 @@ struct fthd_isp_debug_cmd {
 	u32 arg[64];
 };
 
+/* Response of CISP_CMD_DEBUG_HEAP_STATISTICS. Field names are guessed from
+ * the values seen, not confirmed. */
+struct isp_debug_heap_statistics {
+	u32 show_errors;
+	u32 size;
+	u32 used;
+	u32 free;
+	u32 max_used;
+	u32 largest_free;
+	u32 allocs;
+	u32 frees;
+} __attribute__((packed));
+
+/* CISP_CMD_DEBUG_IRQ_STATISTICS returns one counter per interrupt line */
+#define ISP_DEBUG_IRQ_LINES 64
+
 #define to_isp_mem_obj(x) container_of((x), struct isp_mem_obj, base)
 
 extern int isp_init(struct fthd_private *dev_priv);
@@ -720,6 +803,13 @@ extern int fthd_isp_cmd_start(struct fthd_private *dev_priv);
 extern int fthd_isp_cmd_stop(struct fthd_private *dev_priv);
 extern int isp_powerdown(struct fthd_private *dev_priv);
 extern int fthd_isp_cmd_print_enable(struct fthd_private *dev_priv, int enable);
+extern int fthd_isp_set_debug_level(struct fthd_private *dev_priv, int level);
+extern int fthd_isp_ping(struct fthd_private *dev_priv, struct fw_channel *chan,
+			 int count, int depth, struct fthd_ping_result *res);
+extern int fthd_isp_cmd_timeprofile_start(struct fthd_private *dev_priv);
+extern int fthd_isp_cmd_timeprofile_stop(struct fthd_private *dev_priv);
+extern int fthd_isp_cmd_timeprofile_show(struct fthd_private *dev_priv,
+					 struct isp_cmd_timeprofile_show *show);
 extern int fthd_isp_cmd_set_loadfile(struct fthd_private *dev_priv);
 extern int fthd_isp_cmd_channel_info(struct fthd_private *dev_priv);
 extern int fthd_isp_cmd_channel_start(struct fthd_private *dev_priv);
@@ -739,9 +829,14 @@ extern int fthd_isp_cmd_channel_streaming_mode(struct fthd_private *dev_priv, in
 extern int fthd_isp_cmd_channel_frame_rate_min(struct fthd_private *dev_priv, int channel, int rate);
 extern int fthd_isp_cmd_channel_frame_rate_max(struct fthd_private *dev_priv, int channel, int rate);
 extern int fthd_isp_cmd_camera_config(struct fthd_private *dev_priv);
+extern int fthd_isp_cmd_channel_sensor_frame_rate(struct fthd_private *dev_priv, int channel, int rate);
+extern int fthd_isp_set_frame_rate(struct fthd_private *dev_priv, int channel);
 extern int fthd_isp_cmd_channel_ae_speed_set(struct fthd_private *dev_priv, int channel, int speed);
 extern int fthd_isp_cmd_channel_ae_stability_set(struct fthd_private *dev_priv, int channel, int stability);
 extern int fthd_isp_cmd_channel_ae_stability_to_stable_set(struct fthd_private *dev_priv, int channel, int value);
+extern int fthd_isp_cmd_channel_face_detection_config(struct fthd_private *dev_priv, int channel, int max_faces);
+extern int fthd_isp_face_detection(struct fthd_private *dev_priv, int channel, int enable);
+extern void fthd_isp_notify_handler(struct fthd_private *dev_priv, u32 address, u32 size);
 extern int fthd_isp_cmd_channel_face_detection_enable(struct fthd_private *dev_priv, int channel);
 extern int fthd_isp_cmd_channel_face_detection_disable(struct fthd_private *dev_priv, int channel);
 extern int fthd_isp_cmd_channel_face_detection_start(struct fthd_private *dev_priv, int channel);
@@ -758,6 +853,9 @@ extern int fthd_isp_cmd_channel_contrast_set(struct fthd_private *dev_priv, int
 extern int fthd_isp_cmd_channel_saturation_set(struct fthd_private *dev_priv, int channel, int saturation);
 extern int fthd_isp_cmd_channel_hue_set(struct fthd_private *dev_priv, int channel, int hue);
 extern int fthd_isp_cmd_channel_awb(struct fthd_private *dev_priv, int channel, int hue);
+extern int fthd_isp_cmd_channel_ae_param_get(struct fthd_private *dev_priv, int channel,
+					     u32 *integration_time, u32 *gain);
+extern int fthd_isp_cmd_channel_awb_cct_get(struct fthd_private *dev_priv, int channel, u32 *cct);
 extern int fthd_isp_cmd_channel_buffer_return(struct fthd_private *dev_priv, int channel);
 extern int fthd_start_channel(struct fthd_private *dev_priv, int channel);
 extern int fthd_stop_channel(struct fthd_private *dev_priv, int channel);
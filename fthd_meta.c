@@ -0,0 +1,382 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * FacetimeHD camera driver
+ *
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/version.h>
+#include <linux/videodev2.h>
+#include <media/v4l2-dev.h>
+#include <media/v4l2-ioctl.h>
+#include <media/videobuf2-vmalloc.h>
+#include "fthd_drv.h"
+#include "fthd_isp.h"
+#include "fthd_meta.h"
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,12,0)
+
+/*
+ * Period of the AE/AWB reads while streaming. Each read is two firmware
+ * commands, each a round trip on the command channel that queues behind
+ * (and delays) control changes and streaming commands. AE and AWB settle
+ * over many frames, so a few samples a second keep the data current while
+ * staying far below the frame rate; sample_time tells how old they are.
+ */
+#define FTHD_META_PERIOD	200
+
+static void fthd_meta_work(struct work_struct *work)
+{
+	struct fthd_meta *meta = container_of(to_delayed_work(work),
+					      struct fthd_meta, work);
+	struct fthd_private *dev_priv = meta->dev_priv;
+	u32 integration_time, gain, cct;
+	unsigned long flags;
+
+	/* Only a shortcut, the commands themselves are serialized with a reset */
+	if (vb2_is_streaming(&dev_priv->vb2_queue) &&
+	    !atomic_read(&dev_priv->recovering)) {
+		u32 valid = 0;
+
+		if (!fthd_isp_cmd_channel_ae_param_get(dev_priv, 0, &integration_time, &gain))
+			valid |= FTHD_META_AE;
+		if (!fthd_isp_cmd_channel_awb_cct_get(dev_priv, 0, &cct))
+			valid |= FTHD_META_AWB;
+
+		spin_lock_irqsave(&meta->lock, flags);
+		meta->state.valid &= ~(FTHD_META_AE | FTHD_META_AWB);
+		meta->state.valid |= valid;
+		meta->state.sample_time = ktime_get_ns();
+		if (valid & FTHD_META_AE) {
+			meta->state.integration_time = integration_time;
+			meta->state.gain = gain;
+		}
+		if (valid & FTHD_META_AWB)
+			meta->state.cct = cct;
+		spin_unlock_irqrestore(&meta->lock, flags);
+	}
+
+	/* Also waits for the video node to start streaming */
+	schedule_delayed_work(&meta->work, msecs_to_jiffies(FTHD_META_PERIOD));
+}
+
+void fthd_meta_set_motion(struct fthd_private *dev_priv, u32 motion,
+			  unsigned int cells, unsigned int total)
+{
+	struct fthd_meta *meta = dev_priv->meta;
+	unsigned long flags;
+
+	if (!meta)
+		return;
+
+	spin_lock_irqsave(&meta->lock, flags);
+	meta->state.valid |= FTHD_META_MOTION;
+	meta->state.motion = motion;
+	meta->state.motion_cells = cells;
+	meta->state.motion_cells_total = total;
+	spin_unlock_irqrestore(&meta->lock, flags);
+}
+
+void fthd_meta_set_luma(struct fthd_private *dev_priv, const u8 *tiles,
+			const u16 *hist)
+{
+	struct fthd_meta *meta = dev_priv->meta;
+	unsigned long flags;
+
+	if (!meta)
+		return;
+
+	spin_lock_irqsave(&meta->lock, flags);
+	meta->state.valid |= FTHD_META_LUMA;
+	memcpy(meta->state.luma_tiles, tiles, sizeof(meta->state.luma_tiles));
+	memcpy(meta->state.luma_hist, hist, sizeof(meta->state.luma_hist));
+	spin_unlock_irqrestore(&meta->lock, flags);
+}
+
+bool fthd_meta_streaming(struct fthd_private *dev_priv)
+{
+	return dev_priv->meta && vb2_is_streaming(&dev_priv->meta->queue);
+}
+
+/* Called for every frame completed on the video node */
+void fthd_meta_frame_done(struct fthd_private *dev_priv,
+			  struct vb2_v4l2_buffer *frame)
+{
+	struct fthd_meta *meta = dev_priv->meta;
+	struct fthd_meta_buffer *buf;
+	struct fthd_meta_frame *data;
+	unsigned long flags;
+
+	if (!meta || !vb2_is_streaming(&meta->queue))
+		return;
+
+	spin_lock_irqsave(&meta->lock, flags);
+	if (list_empty(&meta->bufs)) {
+		meta->dropped++;
+		spin_unlock_irqrestore(&meta->lock, flags);
+		return;
+	}
+	buf = list_first_entry(&meta->bufs, struct fthd_meta_buffer, list);
+	list_del(&buf->list);
+
+	data = vb2_plane_vaddr(&buf->vb.vb2_buf, 0);
+	*data = meta->state;
+
+	data->version = FTHD_META_VERSION;
+	data->size = sizeof(*data);
+	data->sequence = frame->sequence;
+	data->timestamp = frame->vb2_buf.timestamp;
+
+	buf->vb.sequence = frame->sequence;
+	buf->vb.vb2_buf.timestamp = frame->vb2_buf.timestamp;
+	buf->vb.field = V4L2_FIELD_NONE;
+	vb2_set_plane_payload(&buf->vb.vb2_buf, 0, sizeof(*data));
+	/* Still under the lock, so stop_streaming can't return while this
+	 * buffer is off the list but not yet handed back to vb2 */
+	vb2_buffer_done(&buf->vb.vb2_buf, VB2_BUF_STATE_DONE);
+	spin_unlock_irqrestore(&meta->lock, flags);
+}
+
+static int fthd_meta_queue_setup(struct vb2_queue *vq, unsigned int *nbuffers,
+				 unsigned int *nplanes, unsigned int sizes[],
+				 struct device *alloc_devs[])
+{
+	if (*nplanes)
+		return sizes[0] < sizeof(struct fthd_meta_frame) ? -EINVAL : 0;
+
+	*nplanes = 1;
+	sizes[0] = sizeof(struct fthd_meta_frame);
+	return 0;
+}
+
+static int fthd_meta_buf_prepare(struct vb2_buffer *vb)
+{
+	if (vb2_plane_size(vb, 0) < sizeof(struct fthd_meta_frame))
+		return -EINVAL;
+	return 0;
+}
+
+static void fthd_meta_buf_queue(struct vb2_buffer *vb)
+{
+	struct fthd_meta *meta = vb2_get_drv_priv(vb->vb2_queue);
+	struct fthd_meta_buffer *buf = container_of(to_vb2_v4l2_buffer(vb),
+						    struct fthd_meta_buffer, vb);
+	unsigned long flags;
+
+	spin_lock_irqsave(&meta->lock, flags);
+	list_add_tail(&buf->list, &meta->bufs);
+	spin_unlock_irqrestore(&meta->lock, flags);
+}
+
+static void fthd_meta_return_buffers(struct fthd_meta *meta,
+				     enum vb2_buffer_state state)
+{
+	struct fthd_meta_buffer *buf, *tmp;
+	unsigned long flags;
+	LIST_HEAD(bufs);
+
+	spin_lock_irqsave(&meta->lock, flags);
+	list_splice_init(&meta->bufs, &bufs);
+	spin_unlock_irqrestore(&meta->lock, flags);
+
+	list_for_each_entry_safe(buf, tmp, &bufs, list) {
+		list_del(&buf->list);
+		vb2_buffer_done(&buf->vb.vb2_buf, state);
+	}
+}
+
+static int fthd_meta_start_streaming(struct vb2_queue *vq, unsigned int count)
+{
+	struct fthd_meta *meta = vb2_get_drv_priv(vq);
+
+	memset(&meta->state, 0, sizeof(meta->state));
+	meta->dropped = 0;
+	schedule_delayed_work(&meta->work, 0);
+	return 0;
+}
+
+static void fthd_meta_stop_streaming(struct vb2_queue *vq)
+{
+	struct fthd_meta *meta = vb2_get_drv_priv(vq);
+
+	cancel_delayed_work_sync(&meta->work);
+	fthd_meta_return_buffers(meta, VB2_BUF_STATE_ERROR);
+}
+
+static const struct vb2_ops fthd_meta_queue_ops = {
+	.queue_setup		= fthd_meta_queue_setup,
+	.buf_prepare		= fthd_meta_buf_prepare,
+	.buf_queue		= fthd_meta_buf_queue,
+	.start_streaming	= fthd_meta_start_streaming,
+	.stop_streaming		= fthd_meta_stop_streaming,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(7, 0, 0)
+	.wait_prepare		= vb2_ops_wait_prepare,
+	.wait_finish		= vb2_ops_wait_finish,
+#endif
+};
+
+static int fthd_meta_querycap(struct file *filp, void *priv,
+			      struct v4l2_capability *cap)
+{
+	struct fthd_private *dev_priv = video_drvdata(filp);
+
+	strcpy(cap->driver, "facetimehd");
+	strcpy(cap->card, "Apple Facetime HD");
+	snprintf(cap->bus_info, sizeof(cap->bus_info), "PCI:%s",
+		 pci_name(dev_priv->pdev));
+
+	cap->device_caps = V4L2_CAP_META_CAPTURE | V4L2_CAP_STREAMING;
+	/* Also covers the video node, whose type depends on multiplanar */
+	if (dev_priv->multiplanar)
+		cap->capabilities = V4L2_CAP_VIDEO_CAPTURE_MPLANE;
+	else
+		cap->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_READWRITE;
+	cap->capabilities |= cap->device_caps | V4L2_CAP_DEVICE_CAPS;
+	return 0;
+}
+
+static int fthd_meta_enum_fmt(struct file *filp, void *priv,
+			      struct v4l2_fmtdesc *fmt)
+{
+	if (fmt->index)
+		return -EINVAL;
+
+	fmt->pixelformat = V4L2_META_FMT_FTHD;
+	strscpy(fmt->description, "FacetimeHD frame metadata",
+		sizeof(fmt->description));
+	return 0;
+}
+
+/* Single fixed format, try/get/set all return it */
+static int fthd_meta_g_fmt(struct file *filp, void *priv,
+			   struct v4l2_format *fmt)
+{
+	memset(&fmt->fmt.meta, 0, sizeof(fmt->fmt.meta));
+	fmt->fmt.meta.dataformat = V4L2_META_FMT_FTHD;
+	fmt->fmt.meta.buffersize = sizeof(struct fthd_meta_frame);
+	return 0;
+}
+
+static const struct v4l2_ioctl_ops fthd_meta_ioctl_ops = {
+	.vidioc_querycap	= fthd_meta_querycap,
+	.vidioc_enum_fmt_meta_cap = fthd_meta_enum_fmt,
+	.vidioc_g_fmt_meta_cap	= fthd_meta_g_fmt,
+	.vidioc_s_fmt_meta_cap	= fthd_meta_g_fmt,
+	.vidioc_try_fmt_meta_cap = fthd_meta_g_fmt,
+
+	.vidioc_reqbufs		= vb2_ioctl_reqbufs,
+	.vidioc_create_bufs	= vb2_ioctl_create_bufs,
+	.vidioc_querybuf	= vb2_ioctl_querybuf,
+	.vidioc_qbuf		= vb2_ioctl_qbuf,
+	.vidioc_dqbuf		= vb2_ioctl_dqbuf,
+	.vidioc_expbuf		= vb2_ioctl_expbuf,
+	.vidioc_streamon	= vb2_ioctl_streamon,
+	.vidioc_streamoff	= vb2_ioctl_streamoff,
+};
+
+static const struct v4l2_file_operations fthd_meta_fops = {
+	.owner		= THIS_MODULE,
+	.open		= v4l2_fh_open,
+	.release	= vb2_fop_release,
+	.poll		= vb2_fop_poll,
+	.mmap		= vb2_fop_mmap,
+	.unlocked_ioctl	= video_ioctl2,
+};
+
+static void fthd_meta_release(struct video_device *vdev)
+{
+	kfree(container_of(vdev, struct fthd_meta, vdev));
+}
+
+int fthd_meta_register(struct fthd_private *dev_priv)
+{
+	struct video_device *vdev;
+	struct fthd_meta *meta;
+	struct vb2_queue *q;
+	int ret;
+
+	meta = kzalloc(sizeof(*meta), GFP_KERNEL);
+	if (!meta)
+		return -ENOMEM;
+
+	meta->dev_priv = dev_priv;
+	mutex_init(&meta->queue_lock);
+	spin_lock_init(&meta->lock);
+	INIT_LIST_HEAD(&meta->bufs);
+	INIT_DELAYED_WORK(&meta->work, fthd_meta_work);
+
+	q = &meta->queue;
+	q->type = V4L2_BUF_TYPE_META_CAPTURE;
+	q->io_modes = VB2_MMAP | VB2_USERPTR;
+	q->drv_priv = meta;
+	q->ops = &fthd_meta_queue_ops;
+	q->mem_ops = &vb2_vmalloc_memops;
+	q->buf_struct_size = sizeof(struct fthd_meta_buffer);
+	q->timestamp_flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+	q->lock = &meta->queue_lock;
+
+	ret = vb2_queue_init(q);
+	if (ret)
+		goto fail;
+
+	vdev = &meta->vdev;
+	vdev->v4l2_dev = &dev_priv->v4l2_dev;
+	strscpy(vdev->name, "Apple Facetime HD Metadata", sizeof(vdev->name));
+	vdev->vfl_dir = VFL_DIR_RX;
+	vdev->fops = &fthd_meta_fops;
+	vdev->ioctl_ops = &fthd_meta_ioctl_ops;
+	vdev->queue = q;
+	/* Some failure paths of video_register_device() call the release
+	 * and some don't, so only hand meta over once it succeeded */
+	vdev->release = video_device_release_empty;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,4,0)
+	vdev->device_caps = V4L2_CAP_META_CAPTURE | V4L2_CAP_STREAMING;
+#endif
+	video_set_drvdata(vdev, dev_priv);
+
+	ret = video_register_device(vdev, VFL_TYPE_VIDEO, -1);
+	if (ret)
+		goto fail;
+	vdev->release = fthd_meta_release;
+
+	dev_priv->meta = meta;
+	return 0;
+fail:
+	kfree(meta);
+	return ret;
+}
+
+/*
+ * Must be called with the IRQ and irq_work quiesced: fthd_meta_frame_done()
+ * hands out buffers without holding the queue lock, so a frame completing
+ * while the queue is released would return a buffer vb2 already gave up on.
+ */
+void fthd_meta_unregister(struct fthd_private *dev_priv)
+{
+	struct fthd_meta *meta = dev_priv->meta;
+
+	if (!meta)
+		return;
+
+	dev_priv->meta = NULL;
+
+	/* Stops streaming and frees the buffers now rather than on the last
+	 * close, which also cancels the work */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,10,0)
+	vb2_video_unregister_device(&meta->vdev);
+#else
+	video_unregister_device(&meta->vdev);
+	mutex_lock(&meta->queue_lock);
+	vb2_queue_release(&meta->queue);
+	meta->queue.owner = NULL;
+	mutex_unlock(&meta->queue_lock);
+#endif
+	cancel_delayed_work_sync(&meta->work);
+	/* meta is freed by fthd_meta_release() once the last file is closed */
+}
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * FacetimeHD camera driver
+ *
+ */
+
+#ifndef _FTHD_META_H
+#define _FTHD_META_H
+
+#include <linux/types.h>
+#include <linux/version.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/videodev2.h>
+#include <media/v4l2-dev.h>
+#include <media/videobuf2-v4l2.h>
+#include "fthd_meta_uapi.h"
+
+struct fthd_meta_buffer {
+	struct vb2_v4l2_buffer vb;
+	struct list_head list;
+};
+
+struct fthd_meta {
+	struct fthd_private *dev_priv;
+	/* Freed from the vdev release, open files may outlive the driver */
+	struct video_device vdev;
+	struct vb2_queue queue;
+	struct mutex queue_lock;
+
+	/* Protects bufs and state, taken from the frame return path */
+	spinlock_t lock;
+	struct list_head bufs;
+	/* Latest firmware state, copied into every frame's buffer */
+	struct fthd_meta_frame state;
+	u64 dropped;
+
+	/* Reads the firmware state every FTHD_META_PERIOD ms while streaming */
+	struct delayed_work work;
+};
+
+struct fthd_private;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,12,0)
+extern int fthd_meta_register(struct fthd_private *dev_priv);
+extern void fthd_meta_unregister(struct fthd_private *dev_priv);
+extern void fthd_meta_frame_done(struct fthd_private *dev_priv,
+				 struct vb2_v4l2_buffer *frame);
+extern void fthd_meta_set_motion(struct fthd_private *dev_priv, u32 motion,
+				 unsigned int cells, unsigned int total);
+extern void fthd_meta_set_luma(struct fthd_private *dev_priv, const u8 *tiles,
+			       const u16 *hist);
+extern bool fthd_meta_streaming(struct fthd_private *dev_priv);
+#else
+static inline int fthd_meta_register(struct fthd_private *dev_priv) { return 0; }
+static inline void fthd_meta_unregister(struct fthd_private *dev_priv) { }
+static inline void fthd_meta_frame_done(struct fthd_private *dev_priv,
+					struct vb2_v4l2_buffer *frame) { }
+static inline void fthd_meta_set_motion(struct fthd_private *dev_priv, u32 motion,
+					unsigned int cells, unsigned int total) { }
+static inline void fthd_meta_set_luma(struct fthd_private *dev_priv, const u8 *tiles,
+				      const u16 *hist) { }
+static inline bool fthd_meta_streaming(struct fthd_private *dev_priv) { return false; }
+#endif
+#endif
@@ -0,0 +1,67 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * FacetimeHD camera driver
+ *
+ * Layout of the metadata node's buffers, shared with userspace. Keep this
+ * free of kernel-only includes so applications can use it as is.
+ *
+ */
+
+#ifndef _FTHD_META_UAPI_H
+#define _FTHD_META_UAPI_H
+
+#include <linux/types.h>
+
+/*
+ * Metadata capture node. Every frame returned on the video node completes
+ * one buffer here, holding a struct fthd_meta_frame with the same sequence
+ * number and timestamp. Nothing is collected while no buffers are queued.
+ */
+/* v4l2_fourcc('F', 'T', 'H', 'M'), spelled out to keep videodev2.h out */
+#define V4L2_META_FMT_FTHD	((__u32)'F' | ((__u32)'T' << 8) | \
+				 ((__u32)'H' << 16) | ((__u32)'M' << 24))
+#define FTHD_META_VERSION	5
+
+/* fthd_meta_frame.valid */
+#define FTHD_META_AE		(1 << 0)
+#define FTHD_META_AWB		(1 << 1)
+/* (1 << 2) was face rectangles, dropped in version 5 */
+#define FTHD_META_MOTION	(1 << 3)
+#define FTHD_META_LUMA		(1 << 4)
+
+#define FTHD_META_TILES_W	16
+#define FTHD_META_TILES_H	9
+#define FTHD_META_HIST_BINS	64
+
+struct fthd_meta_frame {
+	__u32 version;		/* FTHD_META_VERSION */
+	__u32 size;		/* of this struct */
+	__u32 sequence;		/* v4l2_buffer.sequence of the frame */
+	__u32 valid;		/* FTHD_META_* */
+	__u64 timestamp;	/* frame timestamp, ns CLOCK_MONOTONIC */
+	__u64 sample_time;	/* when AE/AWB were read, every 200 ms */
+
+	/* FTHD_META_AE, unverified: the firmware's AE_PARAM_GET layout is
+	 * inferred and hasn't been checked against real exposures yet */
+	__u32 integration_time;	/* us */
+	__u32 gain;		/* 8.8 fixed point */
+
+	/* FTHD_META_AWB */
+	__u32 cct;		/* Kelvin */
+	__u32 reserved;
+
+	/* FTHD_META_MOTION, change since the previous frame on a sparse
+	 * luma grid of motion_cells_total samples */
+	__u32 motion;		/* mean absolute luma change, 8.8 fixed point */
+	__u16 motion_cells;	/* samples that changed noticeably */
+	__u16 motion_cells_total;
+
+	/* FTHD_META_LUMA: mean luma of each tile in raster order, over an
+	 * 8x8 subsampled grid of its pixels, and a histogram of those
+	 * samples (4 levels per bin) */
+	__u8 luma_tiles[FTHD_META_TILES_H][FTHD_META_TILES_W];
+	__u16 luma_hist[FTHD_META_HIST_BINS];
+};
+
+#endif
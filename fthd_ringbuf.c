@@ -12,10 +12,12 @@
 #include <linux/pci.h>
 #include <linux/io.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
 #include "fthd_drv.h"
 #include "fthd_hw.h"
 #include "fthd_ringbuf.h"
 #include "fthd_isp.h"
+#include "fthd_trace.h"
 
 u32 get_entry_addr(struct fthd_private *dev_priv,
 			  struct fw_channel *chan, int num)
@@ -43,12 +45,19 @@ void fthd_channel_ringbuf_dump(struct fthd_private *dev_priv, struct fw_channel
 	}
 }
 
+/* Returns true if the entry is currently owned by the host */
+static int fthd_channel_ringbuf_host_owned(struct fthd_private *dev_priv,
+					   struct fw_channel *chan, u32 entry)
+{
+	return !!(FTHD_S2_MEM_READ(entry + FTHD_RINGBUF_ADDRESS_FLAGS) & 1) ^ (chan->type != 0);
+}
+
 void fthd_channel_ringbuf_init(struct fthd_private *dev_priv, struct fw_channel *chan)
 {
 	u32 entry;
 	int i;
 
-	chan->ringbuf.idx = 0;
+	memset(&chan->ringbuf, 0, sizeof(chan->ringbuf));
 
 	if (chan->type == RINGBUF_TYPE_H2T) {
 		pr_debug("clearing ringbuf %s at %08x (size %d)\n",
@@ -66,34 +75,130 @@ void fthd_channel_ringbuf_init(struct fthd_private *dev_priv, struct fw_channel
 	}
 }
 
+static void __fthd_channel_ringbuf_reap(struct fthd_private *dev_priv, struct fw_channel *chan)
+{
+	u32 entry;
+
+	while (chan->ringbuf.depth) {
+		entry = get_entry_addr(dev_priv, chan, chan->ringbuf.tail);
+		if (!fthd_channel_ringbuf_host_owned(dev_priv, chan, entry))
+			break;
+
+		if (++chan->ringbuf.tail >= chan->size)
+			chan->ringbuf.tail = 0;
+		chan->ringbuf.depth--;
+	}
+}
+
+/* Retire host to target entries the firmware has handed back */
+void fthd_channel_ringbuf_reap(struct fthd_private *dev_priv, struct fw_channel *chan)
+{
+	if (chan->type != FW_CHAN_TYPE_OUT)
+		return;
+
+	spin_lock_irq(&chan->lock);
+	__fthd_channel_ringbuf_reap(dev_priv, chan);
+	spin_unlock_irq(&chan->lock);
+}
+
+void fthd_channel_ringbuf_account_rx(struct fthd_private *dev_priv,
+				     struct fw_channel *chan, int count)
+{
+	spin_lock_irq(&chan->lock);
+	chan->ringbuf.received += count;
+	if (count > chan->ringbuf.max_depth)
+		chan->ringbuf.max_depth = count;
+	spin_unlock_irq(&chan->lock);
+}
+
+/*
+ * Wait for the firmware to release the slot at the current index. Only host
+ * to target rings are drained by the firmware on its own, on the other rings
+ * a busy slot means we are out of sync and waiting won't help.
+ */
+static int fthd_channel_ringbuf_wait_free(struct fthd_private *dev_priv,
+					  struct fw_channel *chan)
+{
+	ktime_t start;
+	long ret;
+
+	if (chan->type != FW_CHAN_TYPE_OUT)
+		return -EAGAIN;
+
+	start = ktime_get();
+	ret = wait_event_interruptible_timeout(chan->wq,
+		fthd_channel_ringbuf_host_owned(dev_priv, chan,
+			get_entry_addr(dev_priv, chan, chan->ringbuf.idx)),
+		msecs_to_jiffies(FTHD_RINGBUF_FULL_TIMEOUT));
+
+	spin_lock_irq(&chan->lock);
+	chan->ringbuf.full_wait_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (ret <= 0)
+		chan->ringbuf.full_timeouts++;
+	spin_unlock_irq(&chan->lock);
+
+	if (ret < 0)
+		return ret;
+
+	return ret ? 0 : -EAGAIN;
+}
+
 int fthd_channel_ringbuf_send(struct fthd_private *dev_priv, struct fw_channel *chan,
 			      u32 data_offset, u32 request_size, u32 response_size, u32 *entryp)
 {
-	u32 entry;
+	u32 entry, flags;
+	int ret, idx;
 
 	pr_debug("send %08x\n", data_offset);
 
 	spin_lock_irq(&chan->lock);
+	if (chan->type == FW_CHAN_TYPE_OUT)
+		__fthd_channel_ringbuf_reap(dev_priv, chan);
 	entry = get_entry_addr(dev_priv, chan, chan->ringbuf.idx);
 
+	if (!fthd_channel_ringbuf_host_owned(dev_priv, chan, entry)) {
+		chan->ringbuf.full++;
+		spin_unlock_irq(&chan->lock);
+
+		ret = fthd_channel_ringbuf_wait_free(dev_priv, chan);
+		if (ret)
+			return ret;
+
+		/* Somebody else might have grabbed the slot in the meantime */
+		spin_lock_irq(&chan->lock);
+		__fthd_channel_ringbuf_reap(dev_priv, chan);
+		entry = get_entry_addr(dev_priv, chan, chan->ringbuf.idx);
+		if (!fthd_channel_ringbuf_host_owned(dev_priv, chan, entry)) {
+			spin_unlock_irq(&chan->lock);
+			return -EAGAIN;
+		}
+	}
+
+	/* Only advance once we know the slot is ours */
+	idx = chan->ringbuf.idx;
 	if (++chan->ringbuf.idx >= chan->size)
 		chan->ringbuf.idx = 0;
 
-	if (!(FTHD_S2_MEM_READ(entry + FTHD_RINGBUF_ADDRESS_FLAGS) & 1) ^ (chan->type != 0)) {
-		spin_unlock_irq(&chan->lock);
-		return -EAGAIN;
+	if (chan->type == FW_CHAN_TYPE_OUT) {
+		chan->ringbuf.depth++;
+		if (chan->ringbuf.depth > chan->ringbuf.max_depth)
+			chan->ringbuf.max_depth = chan->ringbuf.depth;
 	}
+	chan->ringbuf.sent++;
 
+	flags = data_offset | (chan->type == 0 ? 0 : 1);
 	FTHD_S2_MEM_WRITE(request_size, entry + FTHD_RINGBUF_REQUEST_SIZE);
 	FTHD_S2_MEM_WRITE(response_size, entry + FTHD_RINGBUF_RESPONSE_SIZE);
 	wmb();
-	FTHD_S2_MEM_WRITE(data_offset | (chan->type == 0 ? 0 : 1),
-			  entry + FTHD_RINGBUF_ADDRESS_FLAGS);
+	FTHD_S2_MEM_WRITE(flags, entry + FTHD_RINGBUF_ADDRESS_FLAGS);
 	spin_unlock_irq(&chan->lock);
 
+	trace_fthd_ring_send(chan->name, idx, entry, flags, request_size, response_size);
+
 	spin_lock_irq(&dev_priv->io_lock);
 	FTHD_ISP_REG_WRITE(0x10 << chan->source, ISP_REG_41020);
 	spin_unlock_irq(&dev_priv->io_lock);
+	trace_fthd_doorbell(chan->name, 0x10 << chan->source);
 	if (entryp)
 		*entryp = entry;
 	return 0;
@@ -109,11 +214,18 @@ u32 fthd_channel_ringbuf_receive(struct fthd_private *dev_priv,
 	entry = get_entry_addr(dev_priv, chan, chan->ringbuf.idx);
 
 
-	if (!(FTHD_S2_MEM_READ(entry + FTHD_RINGBUF_ADDRESS_FLAGS) & 1) ^ (chan->type != 0))
+	if (!fthd_channel_ringbuf_host_owned(dev_priv, chan, entry))
 		goto out;
 
 	ret = entry;
 
+	/* Avoid the extra MMIO reads unless someone is listening */
+	if (trace_fthd_ring_receive_enabled())
+		trace_fthd_ring_receive(chan->name, chan->ringbuf.idx, entry,
+					FTHD_S2_MEM_READ(entry + FTHD_RINGBUF_ADDRESS_FLAGS),
+					FTHD_S2_MEM_READ(entry + FTHD_RINGBUF_REQUEST_SIZE),
+					FTHD_S2_MEM_READ(entry + FTHD_RINGBUF_RESPONSE_SIZE));
+
 	if (chan->type == FW_CHAN_TYPE_OUT && ++chan->ringbuf.idx >= chan->size)
 		chan->ringbuf.idx = 0;
 
@@ -122,11 +234,20 @@ out:
 	return ret;
 }
 
+/*
+ * -ETIMEDOUT only if the firmware really didn't answer in time; a signal
+ * gives -ERESTARTSYS, with the entry still owned by the firmware.
+ */
 int fthd_channel_wait_ready(struct fthd_private *dev_priv, struct fw_channel *chan, u32 entry, int timeout)
 {
-	if (wait_event_interruptible_timeout(chan->wq,
-					     (FTHD_S2_MEM_READ(entry + FTHD_RINGBUF_ADDRESS_FLAGS) & 1) ^ (chan->type != 0),
-		msecs_to_jiffies(timeout)) <= 0) {
+	long ret;
+
+	ret = wait_event_interruptible_timeout(chan->wq,
+					       (FTHD_S2_MEM_READ(entry + FTHD_RINGBUF_ADDRESS_FLAGS) & 1) ^ (chan->type != 0),
+					       msecs_to_jiffies(timeout));
+	if (ret < 0)
+		return ret;
+	if (!ret) {
 		dev_err(&dev_priv->pdev->dev, "%s: timeout\n", chan->name);
 		fthd_channel_ringbuf_dump(dev_priv, chan);
 		return -ETIMEDOUT;
@@ -16,6 +16,9 @@
 #define FTHD_RINGBUF_REQUEST_SIZE 4
 #define FTHD_RINGBUF_RESPONSE_SIZE 8
 
+/* How long a host to target send waits for the firmware to free a slot (ms) */
+#define FTHD_RINGBUF_FULL_TIMEOUT 100
+
 enum ringbuf_type_t {
 	RINGBUF_TYPE_H2T=0,
 	RINGBUF_TYPE_T2H=1,
@@ -25,6 +28,23 @@ enum ringbuf_type_t {
 struct fthd_ringbuf {
 	void *doorbell;
 	int idx;
+	/* Oldest entry still owned by the firmware (host to target only) */
+	int tail;
+
+	/*
+	 * Occupancy accounting, protected by the channel lock. For host to
+	 * target rings depth is the number of entries handed to the firmware
+	 * and not yet returned. For target to host rings it is the number of
+	 * messages drained in one interrupt.
+	 */
+	u32 depth;
+	u32 max_depth;
+	u64 sent;
+	u64 received;
+	u64 full;		/* sends that found the next slot busy */
+	u64 full_timeouts;	/* ... and gave up waiting for it */
+	u64 full_wait_ns;
+	u64 irqs;		/* only updated from the irq work */
 };
 
 struct fw_channel;
@@ -37,6 +57,9 @@ extern int fthd_channel_ringbuf_send(struct fthd_private *dev_priv, struct fw_ch
 
 extern u32 fthd_channel_ringbuf_receive(struct fthd_private *dev_priv,
 					struct fw_channel *chan);
+extern void fthd_channel_ringbuf_reap(struct fthd_private *dev_priv, struct fw_channel *chan);
+extern void fthd_channel_ringbuf_account_rx(struct fthd_private *dev_priv,
+					    struct fw_channel *chan, int count);
 
 extern int fthd_channel_wait_ready(struct fthd_private *dev_priv, struct fw_channel *chan, u32 entry, int timeout);
 extern u32 get_entry_addr(struct fthd_private *dev_priv,
@@ -0,0 +1,232 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * FacetimeHD camera driver
+ *
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM facetimehd
+
+#if !defined(_FTHD_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _FTHD_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/version.h>
+
+/* The source argument of __assign_str() was dropped in 6.10 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,10,0)
+#define fthd_assign_str(dst, src) __assign_str(dst)
+#else
+#define fthd_assign_str(dst, src) __assign_str(dst, src)
+#endif
+
+/*
+ * Frame lifecycle. ctx is the index into dev_priv->h2t_bufs, index the
+ * vb2 buffer index and addr the device address of the first plane as
+ * handed to the firmware in the dma descriptor.
+ */
+DECLARE_EVENT_CLASS(fthd_buffer_class,
+	TP_PROTO(int ctx, unsigned int index, u32 sequence, u32 addr),
+	TP_ARGS(ctx, index, sequence, addr),
+	TP_STRUCT__entry(
+		__field(int, ctx)
+		__field(unsigned int, index)
+		__field(u32, sequence)
+		__field(u32, addr)
+	),
+	TP_fast_assign(
+		__entry->ctx = ctx;
+		__entry->index = index;
+		__entry->sequence = sequence;
+		__entry->addr = addr;
+	),
+	TP_printk("ctx=%d index=%u sequence=%u addr=0x%08x",
+		  __entry->ctx, __entry->index, __entry->sequence, __entry->addr)
+);
+
+DEFINE_EVENT(fthd_buffer_class, fthd_buffer_prepare,
+	TP_PROTO(int ctx, unsigned int index, u32 sequence, u32 addr),
+	TP_ARGS(ctx, index, sequence, addr)
+);
+
+DEFINE_EVENT(fthd_buffer_class, fthd_buffer_queue,
+	TP_PROTO(int ctx, unsigned int index, u32 sequence, u32 addr),
+	TP_ARGS(ctx, index, sequence, addr)
+);
+
+DEFINE_EVENT(fthd_buffer_class, fthd_buffer_return,
+	TP_PROTO(int ctx, unsigned int index, u32 sequence, u32 addr),
+	TP_ARGS(ctx, index, sequence, addr)
+);
+
+TRACE_EVENT(fthd_send_h2t_buffer,
+	TP_PROTO(int ctx, unsigned int index, u32 addr, u32 desc, u32 entry, int ret),
+	TP_ARGS(ctx, index, addr, desc, entry, ret),
+	TP_STRUCT__entry(
+		__field(int, ctx)
+		__field(unsigned int, index)
+		__field(u32, addr)
+		__field(u32, desc)
+		__field(u32, entry)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__entry->ctx = ctx;
+		__entry->index = index;
+		__entry->addr = addr;
+		__entry->desc = desc;
+		__entry->entry = entry;
+		__entry->ret = ret;
+	),
+	TP_printk("ctx=%d index=%u addr=0x%08x desc=0x%08x entry=0x%08x ret=%d",
+		  __entry->ctx, __entry->index, __entry->addr, __entry->desc,
+		  __entry->entry, __entry->ret)
+);
+
+TRACE_EVENT(fthd_buf_t2h,
+	TP_PROTO(u32 entry, u32 address, u32 request_size, u32 response_size),
+	TP_ARGS(entry, address, request_size, response_size),
+	TP_STRUCT__entry(
+		__field(u32, entry)
+		__field(u32, address)
+		__field(u32, request_size)
+		__field(u32, response_size)
+	),
+	TP_fast_assign(
+		__entry->entry = entry;
+		__entry->address = address;
+		__entry->request_size = request_size;
+		__entry->response_size = response_size;
+	),
+	TP_printk("entry=0x%08x address=0x%08x request_size=0x%08x response_size=0x%08x",
+		  __entry->entry, __entry->address, __entry->request_size,
+		  __entry->response_size)
+);
+
+TRACE_EVENT(fthd_buffer_done,
+	TP_PROTO(int ctx, unsigned int index, u32 sequence, int state),
+	TP_ARGS(ctx, index, sequence, state),
+	TP_STRUCT__entry(
+		__field(int, ctx)
+		__field(unsigned int, index)
+		__field(u32, sequence)
+		__field(int, state)
+	),
+	TP_fast_assign(
+		__entry->ctx = ctx;
+		__entry->index = index;
+		__entry->sequence = sequence;
+		__entry->state = state;
+	),
+	TP_printk("ctx=%d index=%u sequence=%u state=%d",
+		  __entry->ctx, __entry->index, __entry->sequence, __entry->state)
+);
+
+/*
+ * IPC rings. idx is the slot within the ring, entry its S2 address and
+ * flags the ADDRESS_FLAGS word as written by the host or read back from
+ * the firmware.
+ */
+DECLARE_EVENT_CLASS(fthd_ring_class,
+	TP_PROTO(const char *name, int idx, u32 entry, u32 flags,
+		 u32 request_size, u32 response_size),
+	TP_ARGS(name, idx, entry, flags, request_size, response_size),
+	TP_STRUCT__entry(
+		__string(name, name)
+		__field(int, idx)
+		__field(u32, entry)
+		__field(u32, flags)
+		__field(u32, request_size)
+		__field(u32, response_size)
+	),
+	TP_fast_assign(
+		fthd_assign_str(name, name);
+		__entry->idx = idx;
+		__entry->entry = entry;
+		__entry->flags = flags;
+		__entry->request_size = request_size;
+		__entry->response_size = response_size;
+	),
+	TP_printk("%s idx=%d entry=0x%08x flags=0x%08x request_size=0x%08x response_size=0x%08x",
+		  __get_str(name), __entry->idx, __entry->entry, __entry->flags,
+		  __entry->request_size, __entry->response_size)
+);
+
+DEFINE_EVENT(fthd_ring_class, fthd_ring_send,
+	TP_PROTO(const char *name, int idx, u32 entry, u32 flags,
+		 u32 request_size, u32 response_size),
+	TP_ARGS(name, idx, entry, flags, request_size, response_size)
+);
+
+DEFINE_EVENT(fthd_ring_class, fthd_ring_receive,
+	TP_PROTO(const char *name, int idx, u32 entry, u32 flags,
+		 u32 request_size, u32 response_size),
+	TP_ARGS(name, idx, entry, flags, request_size, response_size)
+);
+
+TRACE_EVENT(fthd_doorbell,
+	TP_PROTO(const char *name, u32 value),
+	TP_ARGS(name, value),
+	TP_STRUCT__entry(
+		__string(name, name)
+		__field(u32, value)
+	),
+	TP_fast_assign(
+		fthd_assign_str(name, name);
+		__entry->value = value;
+	),
+	TP_printk("%s value=0x%08x", __get_str(name), __entry->value)
+);
+
+/* IRQ dispatch, pending is the raw ISP_IRQ_STATUS value */
+TRACE_EVENT(fthd_irq_handler,
+	TP_PROTO(u32 pending),
+	TP_ARGS(pending),
+	TP_STRUCT__entry(
+		__field(u32, pending)
+	),
+	TP_fast_assign(
+		__entry->pending = pending;
+	),
+	TP_printk("pending=0x%08x", __entry->pending)
+);
+
+TRACE_EVENT(fthd_irq_work,
+	TP_PROTO(u32 pending, int loop),
+	TP_ARGS(pending, loop),
+	TP_STRUCT__entry(
+		__field(u32, pending)
+		__field(int, loop)
+	),
+	TP_fast_assign(
+		__entry->pending = pending;
+		__entry->loop = loop;
+	),
+	TP_printk("pending=0x%08x loop=%d", __entry->pending, __entry->loop)
+);
+
+TRACE_EVENT(fthd_handle_irq,
+	TP_PROTO(const char *name, int source, u32 pending),
+	TP_ARGS(name, source, pending),
+	TP_STRUCT__entry(
+		__string(name, name)
+		__field(int, source)
+		__field(u32, pending)
+	),
+	TP_fast_assign(
+		fthd_assign_str(name, name);
+		__entry->source = source;
+		__entry->pending = pending;
+	),
+	TP_printk("%s source=%d pending=0x%08x", __get_str(name),
+		  __entry->source, __entry->pending)
+);
+
+#endif /* _FTHD_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE fthd_trace
+#include <trace/define_trace.h>
@@ -12,6 +12,7 @@
 #include <linux/sched.h>
 #include <linux/wait.h>
 #include <linux/delay.h>
+#include <linux/dma-mapping.h>
 #include <linux/version.h>
 #include <linux/videodev2.h>
 #include <media/v4l2-dev.h>
@@ -24,6 +25,8 @@
 #include "fthd_isp.h"
 #include "fthd_ringbuf.h"
 #include "fthd_buffer.h"
+#include "fthd_meta.h"
+#include "fthd_trace.h"
 
 /* Fallback ceiling used only if the sensor's native size wasn't detected.
  * The real per-device limit is dev_priv->sensor_width/height. */
@@ -31,7 +34,42 @@
 #define FTHD_MAX_HEIGHT 720
 #define FTHD_MIN_WIDTH 320
 #define FTHD_MIN_HEIGHT 240
-#define FTHD_NUM_FORMATS 2 /* NV16 is disabled for now */
+#define FTHD_STEP_WIDTH 8
+#define FTHD_STEP_HEIGHT 2
+/* Largest upscale of a selection crop to the output size */
+#define FTHD_MAX_ZOOM 4
+
+struct fthd_format {
+	u32 fourcc;
+	const char *desc;
+	int planes;
+};
+
+/*
+ * The firmware writes NV16 as two separate planes (addr0/addr1 of the dma
+ * descriptor), which only the multi-planar API can describe.
+ */
+static const struct fthd_format fthd_formats[] = {
+	{ V4L2_PIX_FMT_YUYV, "YUYV", 1 },
+	{ V4L2_PIX_FMT_YVYU, "YVYU", 1 },
+	{ V4L2_PIX_FMT_NV16M, "NV16M", 2 },
+};
+
+#define FTHD_NUM_FORMATS ARRAY_SIZE(fthd_formats)
+
+static const struct fthd_format *fthd_v4l2_find_format(struct fthd_private *dev_priv,
+						       u32 fourcc)
+{
+	int i;
+
+	for (i = 0; i < FTHD_NUM_FORMATS; i++) {
+		if (fthd_formats[i].planes > 1 && !dev_priv->multiplanar)
+			continue;
+		if (fthd_formats[i].fourcc == fourcc)
+			return &fthd_formats[i];
+	}
+	return NULL;
+}
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5, 7, 0)
 # define VFL_TYPE_VIDEO VFL_TYPE_GRABBER
@@ -56,20 +94,26 @@ static int fthd_buffer_queue_setup(
 ) {
 
 	struct fthd_private *dev_priv = vb2_get_drv_priv(vq);
-	struct v4l2_pix_format *cur_fmt = &dev_priv->fmt.fmt;
+	struct fthd_fmt *cur_fmt = &dev_priv->fmt;
 	int i, total_size = 0;
 
-	if (*nplanes)
-		return sizes[0] < (cur_fmt->bytesperline * cur_fmt->height) ? -EINVAL : 0;
+	if (*nplanes) {
+		if (*nplanes != cur_fmt->planes)
+			return -EINVAL;
+		for (i = 0; i < *nplanes; i++) {
+			if (sizes[i] < cur_fmt->plane_size[i])
+				return -EINVAL;
+		}
+		return 0;
+	}
 
-	*nplanes = dev_priv->fmt.planes;
+	*nplanes = cur_fmt->planes;
 
 	if (!*nplanes)
 		return -EINVAL;
 
-	/* FIXME: We assume single plane format here but not below */
 	for (i = 0; i < *nplanes; i++) {
-		sizes[i] = cur_fmt->sizeimage;
+		sizes[i] = cur_fmt->plane_size[i];
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4,8,0)
 		alloc_devs[i] = &dev_priv->pdev->dev;
 #else
@@ -116,19 +160,31 @@ static void fthd_buffer_cleanup(struct vb2_buffer *vb)
 
 static int fthd_send_h2t_buffer(struct fthd_private *dev_priv, struct h2t_buf_ctx *ctx)
 {
-	u32 entry;
+	u32 entry = 0;
 	int ret;
 
+	down_read(&dev_priv->cmd_rwsem);
+	if (dev_priv->isp_dead || !ctx->dma_desc_obj) {
+		ret = -ENODEV;
+		goto out;
+	}
+
 	pr_debug("sending buffer %p size %ld, ctx %p\n", ctx->vb, sizeof(ctx->dma_desc_list), ctx);
 	FTHD_S2_MEMCPY_TOIO(ctx->dma_desc_obj->offset, &ctx->dma_desc_list, sizeof(ctx->dma_desc_list));
 	ret = fthd_channel_ringbuf_send(dev_priv, dev_priv->channel_buf_h2t,
 					ctx->dma_desc_obj->offset, 0x180, 0x30000000, &entry);
+	trace_fthd_send_h2t_buffer(ctx - dev_priv->h2t_bufs, ctx->vb->index,
+				   ctx->dma_desc_list.desc[0].addr0,
+				   ctx->dma_desc_obj->offset, entry, ret);
 
 	if (ret) {
 		pr_err("%s: fthd_channel_ringbuf_send: %d\n", __FUNCTION__, ret);
-		return ret;
+		goto out;
 	}
-	return fthd_channel_wait_ready(dev_priv, dev_priv->channel_buf_h2t, entry, 2000);
+	ret = fthd_channel_wait_ready(dev_priv, dev_priv->channel_buf_h2t, entry, 2000);
+out:
+	up_read(&dev_priv->cmd_rwsem);
+	return ret;
 }
 
 static void fthd_buffer_queue(struct vb2_buffer *vb)
@@ -152,6 +208,9 @@ static void fthd_buffer_queue(struct vb2_buffer *vb)
 	if (ctx->state != BUF_ALLOC)
 		return;
 
+	trace_fthd_buffer_queue(i, vb->index, dev_priv->sequence,
+				ctx->dma_desc_list.desc[0].addr0);
+
 	if (!vb->vb2_queue->streaming) {
 		ctx->state = BUF_DRV_QUEUED;
 	} else {
@@ -163,6 +222,8 @@ static void fthd_buffer_queue(struct vb2_buffer *vb)
 			 list->desc[i].count, list->desc[i].pool, list->desc[i].addr0, list->desc[i].addr1, list->desc[i].tag, ctx->vb);
 
 		if (fthd_send_h2t_buffer(dev_priv, ctx)) {
+			trace_fthd_buffer_done(i, vb->index, dev_priv->sequence,
+					       VB2_BUF_STATE_ERROR);
 			vb2_buffer_done(vb, VB2_BUF_STATE_ERROR);
 			ctx->state = BUF_ALLOC;
 		}
@@ -190,6 +251,10 @@ static int fthd_buffer_prepare(struct vb2_buffer *vb)
 	if (!ctx)
 		return -ENOBUFS;
 
+	/* ISP memory is gone after a failed recovery */
+	if (dev_priv->isp_dead)
+		return -ENODEV;
+
 	if (ctx->state == BUF_FREE) {
 		pr_debug("allocating new entry\n");
 		ctx->dma_desc_obj = isp_mem_create(dev_priv, FTHD_MEM_BUFFER, 0x180);
@@ -207,7 +272,11 @@ static int fthd_buffer_prepare(struct vb2_buffer *vb)
 		}
 	}
 
-	vb2_set_plane_payload(vb, 0, dev_priv->fmt.fmt.sizeimage);
+	for (i = 0; i < dev_priv->fmt.planes; i++) {
+		if (vb2_plane_size(vb, i) < dev_priv->fmt.plane_size[i])
+			return -EINVAL;
+		vb2_set_plane_payload(vb, i, dev_priv->fmt.plane_size[i]);
+	}
 
 	dma_list = &ctx->dma_desc_list;
 	memset(dma_list, 0, 0x180);
@@ -225,9 +294,167 @@ static int fthd_buffer_prepare(struct vb2_buffer *vb)
 
 	dma_list->desc[0].tag = (u64)ctx;
 	init_waitqueue_head(&ctx->wq);
+
+	trace_fthd_buffer_prepare(ctx - dev_priv->h2t_bufs, vb->index,
+				  dev_priv->sequence, dma_list->desc[0].addr0);
 	return 0;
 }
 
+/* Average the delivered frame interval over roughly the last 8 frames */
+static void fthd_v4l2_frame_interval(struct fthd_private *dev_priv, u64 now)
+{
+	u64 delta = now - dev_priv->frame_last_ns;
+
+	if (dev_priv->frame_last_ns) {
+		if (dev_priv->frame_interval_ns)
+			dev_priv->frame_interval_ns = (dev_priv->frame_interval_ns * 7 + delta) / 8;
+		else
+			dev_priv->frame_interval_ns = delta;
+	}
+	dev_priv->frame_last_ns = now;
+}
+
+/* Motion against the previous frame's grid, see fthd_v4l2_frame_stats() */
+static void fthd_v4l2_motion(struct fthd_private *dev_priv,
+			     struct vb2_v4l2_buffer *vbuf, const u8 *grid)
+{
+	unsigned int i, cells = 0, sum = 0;
+	int diff, active;
+
+	for (i = 0; i < FTHD_LUMA_CELLS; i++) {
+		diff = abs(grid[i] - dev_priv->luma_grid[i]);
+		sum += diff;
+		if (diff >= FTHD_MOTION_CELL_DELTA)
+			cells++;
+	}
+	memcpy(dev_priv->luma_grid, grid, FTHD_LUMA_CELLS);
+
+	/* First frame after start only fills the grid */
+	if (!dev_priv->luma_grid_valid) {
+		dev_priv->luma_grid_valid = 1;
+		return;
+	}
+
+	fthd_meta_set_motion(dev_priv, sum * 256 / FTHD_LUMA_CELLS, cells,
+			     FTHD_LUMA_CELLS);
+
+	/* Events on both edges, region_mask 0 means motion stopped */
+	active = dev_priv->md_mode == V4L2_DETECT_MD_MODE_GLOBAL &&
+		 cells >= dev_priv->md_threshold;
+	if (active != dev_priv->motion_active) {
+		struct v4l2_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.type = V4L2_EVENT_MOTION_DET;
+		ev.u.motion_det.flags = V4L2_EVENT_MD_FL_HAVE_FRAME_SEQ;
+		ev.u.motion_det.frame_sequence = vbuf->sequence;
+		ev.u.motion_det.region_mask = active;
+		v4l2_event_queue(dev_priv->videodev, &ev);
+		dev_priv->motion_active = active;
+	}
+}
+
+/* Pixels sampled per tile in each direction for the luma statistics */
+#define FTHD_LUMA_TILE_SAMPLES	8
+
+/*
+ * Tile means and a histogram for the metadata node. Each tile is averaged
+ * over an 8x8 grid spread evenly across its pixels, which is far more
+ * stable than the motion grid's few points per tile; the histogram counts
+ * the same samples. About 9000 byte reads per frame.
+ */
+static void fthd_v4l2_luma_stats(struct fthd_private *dev_priv, const u8 *luma,
+				 unsigned int step)
+{
+	const unsigned int nx = FTHD_META_TILES_W * FTHD_LUMA_TILE_SAMPLES;
+	const unsigned int ny = FTHD_META_TILES_H * FTHD_LUMA_TILE_SAMPLES;
+	struct fthd_fmt *fmt = &dev_priv->fmt;
+	u32 sums[FTHD_META_TILES_H * FTHD_META_TILES_W];
+	u16 hist[FTHD_META_HIST_BINS];
+	u8 tiles[FTHD_META_TILES_H * FTHD_META_TILES_W];
+	unsigned int x, y, px, tile;
+	const u8 *row;
+	u8 val;
+
+	memset(sums, 0, sizeof(sums));
+	memset(hist, 0, sizeof(hist));
+
+	for (y = 0; y < ny; y++) {
+		row = luma + (2 * y + 1) * fmt->fmt.height / (2 * ny) *
+			fmt->plane_bpl[0];
+		for (x = 0; x < nx; x++) {
+			px = (2 * x + 1) * fmt->fmt.width / (2 * nx);
+			val = row[px * step];
+			tile = y / FTHD_LUMA_TILE_SAMPLES * FTHD_META_TILES_W +
+			       x / FTHD_LUMA_TILE_SAMPLES;
+			sums[tile] += val;
+			hist[val * FTHD_META_HIST_BINS / 256]++;
+		}
+	}
+
+	for (tile = 0; tile < ARRAY_SIZE(tiles); tile++)
+		tiles[tile] = sums[tile] /
+			(FTHD_LUMA_TILE_SAMPLES * FTHD_LUMA_TILE_SAMPLES);
+
+	fthd_meta_set_luma(dev_priv, tiles, hist);
+}
+
+/*
+ * Sample luma at one point per grid cell of a finished frame for motion
+ * detection, and more densely for the luma statistics on the metadata
+ * node. Cheap enough to leave on. The plane has to be synced for the CPU
+ * first, which vb2 only does later in vb2_buffer_done(); that's free on
+ * coherent x86 but copies the plane when it is bounced through swiotlb.
+ * Only MMAP buffers are sampled: USERPTR and DMABUF planes would need a
+ * kernel mapping set up per frame. The firmware computes the same kind of
+ * data (motion history, AE tiles, histograms), but no way to read it back
+ * is known, so enabling it would only add firmware work.
+ */
+static void fthd_v4l2_frame_stats(struct fthd_private *dev_priv,
+				  struct vb2_v4l2_buffer *vbuf)
+{
+	struct fthd_fmt *fmt = &dev_priv->fmt;
+	struct sg_table *sgt;
+	u8 grid[FTHD_LUMA_CELLS];
+	unsigned int x, y, px, step, cell = 0;
+	const u8 *luma, *row;
+	bool meta = fthd_meta_streaming(dev_priv);
+
+	if (dev_priv->md_mode == V4L2_DETECT_MD_MODE_DISABLED && !meta)
+		return;
+
+	if (vbuf->vb2_buf.memory != V4L2_MEMORY_MMAP)
+		return;
+
+	sgt = vb2_dma_sg_plane_desc(&vbuf->vb2_buf, 0);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,8,0)
+	dma_sync_sgtable_for_cpu(&dev_priv->pdev->dev, sgt, DMA_FROM_DEVICE);
+#else
+	dma_sync_sg_for_cpu(&dev_priv->pdev->dev, sgt->sgl, sgt->orig_nents,
+			    DMA_FROM_DEVICE);
+#endif
+
+	luma = vb2_plane_vaddr(&vbuf->vb2_buf, 0);
+	if (!luma)
+		return;
+
+	/* Y is every other byte of the packed formats, NV16M has a Y plane */
+	step = fmt->fmt.pixelformat == V4L2_PIX_FMT_NV16M ? 1 : 2;
+
+	for (y = 0; y < FTHD_LUMA_GRID_H; y++) {
+		row = luma + (2 * y + 1) * fmt->fmt.height / (2 * FTHD_LUMA_GRID_H) *
+			fmt->plane_bpl[0];
+		for (x = 0; x < FTHD_LUMA_GRID_W; x++, cell++) {
+			px = (2 * x + 1) * fmt->fmt.width / (2 * FTHD_LUMA_GRID_W);
+			grid[cell] = row[px * step];
+		}
+	}
+
+	fthd_v4l2_motion(dev_priv, vbuf, grid);
+	if (meta)
+		fthd_v4l2_luma_stats(dev_priv, luma, step);
+}
+
 void fthd_buffer_return_handler(struct fthd_private *dev_priv, u32 offset, int size)
 {
 	struct dma_descriptor_list list;
@@ -244,17 +471,89 @@ void fthd_buffer_return_handler(struct fthd_private *dev_priv, u32 offset, int s
 		if (ctx->state == BUF_HW_QUEUED || ctx->state == BUF_DRV_QUEUED) {
 			struct vb2_v4l2_buffer *vbuf = to_vb2_v4l2_buffer(ctx->vb);
 
+			trace_fthd_buffer_return(ctx - dev_priv->h2t_bufs, ctx->vb->index,
+						 dev_priv->sequence, list.desc[i].addr0);
+
 			vbuf->sequence = dev_priv->sequence++;
 			vbuf->vb2_buf.timestamp = ktime_get_ns();
+			fthd_v4l2_frame_interval(dev_priv, vbuf->vb2_buf.timestamp);
 			vbuf->field = V4L2_FIELD_NONE;
+			fthd_v4l2_frame_stats(dev_priv, vbuf);
+			fthd_meta_frame_done(dev_priv, vbuf);
 
 			ctx->state = BUF_ALLOC;
+			trace_fthd_buffer_done(ctx - dev_priv->h2t_bufs, ctx->vb->index,
+					       vbuf->sequence, VB2_BUF_STATE_DONE);
 			vb2_buffer_done(ctx->vb, VB2_BUF_STATE_DONE);
 		}
 
 	}
 }
 
+/*
+ * Called before the ISP is reset. Descriptor objects live in ISP memory,
+ * which is torn down with the firmware, so release them and remember which
+ * buffers the firmware had. The IOMMU mappings of the planes are kept.
+ */
+void fthd_v4l2_recovery_prepare(struct fthd_private *dev_priv)
+{
+	struct h2t_buf_ctx *ctx;
+	int i;
+
+	for (i = 0; i < FTHD_BUFFERS; i++) {
+		ctx = dev_priv->h2t_bufs + i;
+		if (ctx->state == BUF_FREE)
+			continue;
+
+		if (ctx->state == BUF_HW_QUEUED)
+			ctx->state = BUF_DRV_QUEUED;
+
+		isp_mem_destroy(ctx->dma_desc_obj);
+		ctx->dma_desc_obj = NULL;
+	}
+}
+
+/* Called once the firmware is running again */
+int fthd_v4l2_recovery_finish(struct fthd_private *dev_priv)
+{
+	struct h2t_buf_ctx *ctx;
+	int i, ret;
+
+	for (i = 0; i < FTHD_BUFFERS; i++) {
+		ctx = dev_priv->h2t_bufs + i;
+		if (ctx->state == BUF_FREE)
+			continue;
+
+		ctx->dma_desc_obj = isp_mem_create(dev_priv, FTHD_MEM_BUFFER, 0x180);
+		if (!ctx->dma_desc_obj)
+			return -ENOMEM;
+	}
+
+	if (!vb2_is_streaming(&dev_priv->vb2_queue))
+		return 0;
+
+	ret = fthd_start_channel(dev_priv, 0);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < FTHD_BUFFERS; i++) {
+		ctx = dev_priv->h2t_bufs + i;
+		if (ctx->state != BUF_DRV_QUEUED)
+			continue;
+
+		ctx->dma_desc_list.field0 = 1;
+		ctx->state = BUF_HW_QUEUED;
+		wmb();
+		if (fthd_send_h2t_buffer(dev_priv, ctx)) {
+			trace_fthd_buffer_done(i, ctx->vb->index, dev_priv->sequence,
+					       VB2_BUF_STATE_ERROR);
+			vb2_buffer_done(ctx->vb, VB2_BUF_STATE_ERROR);
+			ctx->state = BUF_ALLOC;
+		}
+	}
+	return 0;
+}
+
 static int fthd_start_streaming(struct vb2_queue *vq, unsigned int count)
 {
 	struct fthd_private *dev_priv = vb2_get_drv_priv(vq);
@@ -263,8 +562,18 @@ static int fthd_start_streaming(struct vb2_queue *vq, unsigned int count)
 
 	pr_debug("count = %d\n", count);
 	dev_priv->sequence = 0;
-
+	dev_priv->frame_last_ns = 0;
+	dev_priv->frame_interval_ns = 0;
+	dev_priv->luma_grid_valid = 0;
+	dev_priv->motion_active = 0;
+
+	/* fthd_start_channel() programs the current control values; a
+	 * control set meanwhile waits and then goes to the firmware itself */
+	mutex_lock(dev_priv->v4l2_ctrl_handler.lock);
 	ret = fthd_start_channel(dev_priv, 0);
+	if (!ret)
+		dev_priv->channel_started = 1;
+	mutex_unlock(dev_priv->v4l2_ctrl_handler.lock);
 	if (ret)
 		return ret;
 
@@ -274,11 +583,15 @@ static int fthd_start_streaming(struct vb2_queue *vq, unsigned int count)
 			continue;
 
 		if (fthd_send_h2t_buffer(dev_priv, ctx)) {
+			trace_fthd_buffer_done(i, ctx->vb->index, dev_priv->sequence,
+					       VB2_BUF_STATE_ERROR);
 			vb2_buffer_done(ctx->vb, VB2_BUF_STATE_ERROR);
 			ctx->state = BUF_ALLOC;
 		}
 			ctx->state = BUF_HW_QUEUED;
 	}
+
+	fthd_watchdog_start(dev_priv);
 	return 0;
 }
 
@@ -288,6 +601,12 @@ static void fthd_stop_streaming(struct vb2_queue *vq)
 	struct h2t_buf_ctx *ctx;
 	int ret, i;
 
+	fthd_watchdog_stop(dev_priv);
+
+	mutex_lock(dev_priv->v4l2_ctrl_handler.lock);
+	dev_priv->channel_started = 0;
+	mutex_unlock(dev_priv->v4l2_ctrl_handler.lock);
+
 	ret = fthd_stop_channel(dev_priv, 0);
 	if (!ret) {
 		pr_debug("waiting for buffers...\n");
@@ -298,6 +617,8 @@ static void fthd_stop_streaming(struct vb2_queue *vq)
 	    for(i = 0; i < FTHD_BUFFERS;i++) {
 		    ctx = dev_priv->h2t_bufs + i;
 		    if (ctx->state == BUF_DRV_QUEUED || ctx->state == BUF_HW_QUEUED) {
+			    trace_fthd_buffer_done(i, ctx->vb->index, dev_priv->sequence,
+						   VB2_BUF_STATE_DONE);
 			    vb2_buffer_done(ctx->vb, VB2_BUF_STATE_DONE);
 			    ctx->vb = NULL;
 			    ctx->state = BUF_ALLOC;
@@ -367,8 +688,11 @@ static int fthd_v4l2_ioctl_querycap(struct file *filp, void *priv,
 	snprintf(cap->bus_info, sizeof(cap->bus_info), "PCI:%s",
 		 pci_name(dev_priv->pdev));
 
-	cap->device_caps = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_READWRITE |
-			   V4L2_CAP_STREAMING;
+	if (dev_priv->multiplanar)
+		cap->device_caps = V4L2_CAP_VIDEO_CAPTURE_MPLANE | V4L2_CAP_STREAMING;
+	else
+		cap->device_caps = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_READWRITE |
+				   V4L2_CAP_STREAMING;
 	cap->capabilities = cap->device_caps | V4L2_CAP_DEVICE_CAPS;
 	return 0;
 }
@@ -376,35 +700,97 @@ static int fthd_v4l2_ioctl_querycap(struct file *filp, void *priv,
 static int fthd_v4l2_ioctl_enum_fmt_vid_cap(struct file *filp, void *priv,
 				   struct v4l2_fmtdesc *fmt)
 {
-	char *desc = NULL;
+	struct fthd_private *dev_priv = video_drvdata(filp);
+	int i, index = 0;
 
-	switch (fmt->index) {
-	case 0:
-		fmt->pixelformat = V4L2_PIX_FMT_YUYV;
-		desc = "YUYV";
-		break;
-	case 1:
-		fmt->pixelformat = V4L2_PIX_FMT_YVYU;
-		desc = "YVYU";
-		break;
-	/* We don't support the mplane yet
-	case 2:
-		fmt->pixelformat = V4L2_PIX_FMT_NV16;
-		desc = "NV16";
-		break;
-	*/
-	default:
+	if (fmt->type != dev_priv->vb2_queue.type)
 		return -EINVAL;
+
+	for (i = 0; i < FTHD_NUM_FORMATS; i++) {
+		if (fthd_formats[i].planes > 1 && !dev_priv->multiplanar)
+			continue;
+		if (index++ == fmt->index)
+			break;
 	}
 
-	fmt->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	strncpy(fmt->description, desc, sizeof(fmt->description));
+	if (i == FTHD_NUM_FORMATS)
+		return -EINVAL;
+
+	fmt->pixelformat = fthd_formats[i].fourcc;
+	strscpy(fmt->description, fthd_formats[i].desc, sizeof(fmt->description));
 
 	return 0;
 }
 
+/* Rates offered, fastest first. None is above FTHD_SENSOR_MODE_FPS, as
+ * no sensor mode is known to run faster. */
+static const unsigned int fthd_frame_rates[] = { 30, 25, 24, 20, 15, 10, 5 };
+
+/* Closest offered rate to den/num fps */
+static unsigned int fthd_v4l2_snap_fps(u32 num, u32 den)
+{
+	unsigned int fps = 0, mfps, rate, diff, best = UINT_MAX;
+	int i;
+
+	/* in millihertz, so 30000/1001 snaps to 30 */
+	mfps = num ? min_t(u64, div_u64((u64)den * 1000, num), UINT_MAX) : UINT_MAX;
+
+	for (i = 0; i < ARRAY_SIZE(fthd_frame_rates); i++) {
+		rate = fthd_frame_rates[i] * 1000;
+		diff = rate > mfps ? rate - mfps : mfps - rate;
+		if (diff < best) {
+			best = diff;
+			fps = fthd_frame_rates[i];
+		}
+	}
+	return fps;
+}
+
+/*
+ * Pick the smallest sensor mode that covers the output size. Smaller
+ * readouts bin or skip lines and take less power. The frame rate plays no
+ * part, the presets' rates aren't known.
+ */
+static const struct fthd_sensor_mode *fthd_v4l2_pick_mode(struct fthd_private *dev_priv,
+							  unsigned int width,
+							  unsigned int height)
+{
+	const struct fthd_sensor_mode *mode, *best = NULL;
+	int i;
+
+	for (i = 0; i < dev_priv->num_sensor_modes; i++) {
+		mode = &dev_priv->sensor_modes[i];
+		if (mode->width < width || mode->height < height)
+			continue;
+		if (!best || mode->width * mode->height < best->width * best->height)
+			best = mode;
+	}
+
+	return best;
+}
+
+/*
+ * The ISP scales the cropped sensor area to the output size. Crop the
+ * largest centered window with the output aspect ratio so a smaller
+ * format keeps the full field of view instead of cutting out a corner.
+ */
+static void fthd_v4l2_default_crop(struct fthd_fmt *f, unsigned int width,
+				   unsigned int height)
+{
+	if (width * f->win_h > height * f->win_w) {
+		f->x2 = f->win_w;
+		f->y2 = round_down(f->win_w * height / width, 2);
+	} else {
+		f->x2 = round_down(f->win_h * width / height, 2);
+		f->y2 = f->win_h;
+	}
+	f->x1 = round_down((f->win_w - f->x2) / 2, 2);
+	f->y1 = round_down((f->win_h - f->y2) / 2, 2);
+}
+
 static int fthd_v4l2_adjust_format(struct fthd_private *dev_priv,
-				   struct v4l2_pix_format *pix)
+				   struct v4l2_pix_format *pix,
+				   struct fthd_fmt *f)
 {
 
 	/* Upper bound is the sensor's native resolution (e.g. 1280x720 on
@@ -412,10 +798,16 @@ static int fthd_v4l2_adjust_format(struct fthd_private *dev_priv,
 	 * ceiling if it hasn't been detected yet. */
 	unsigned int max_w = dev_priv->sensor_width  ? : FTHD_MAX_WIDTH;
 	unsigned int max_h = dev_priv->sensor_height ? : FTHD_MAX_HEIGHT;
+	const struct fthd_sensor_mode *mode;
+	const struct fthd_format *format;
+	unsigned int win_w, win_h;
+	int i;
 
-	if (pix->pixelformat != V4L2_PIX_FMT_YUYV &&
-	    pix->pixelformat != V4L2_PIX_FMT_YVYU)
-		pix->pixelformat = V4L2_PIX_FMT_YUYV;
+	format = fthd_v4l2_find_format(dev_priv, pix->pixelformat);
+	if (!format) {
+		format = &fthd_formats[0];
+		pix->pixelformat = format->fourcc;
+	}
 
 	if (pix->width < FTHD_MIN_WIDTH)
 		pix->width = FTHD_MIN_WIDTH;
@@ -428,23 +820,47 @@ static int fthd_v4l2_adjust_format(struct fthd_private *dev_priv,
 
 	pix->colorspace = V4L2_COLORSPACE_SRGB;
 	pix->field = V4L2_FIELD_NONE;
-	pix->width = ALIGN(pix->width, 7);
+	pix->width = round_down(pix->width, FTHD_STEP_WIDTH);
+	pix->height = round_down(pix->height, FTHD_STEP_HEIGHT);
+
+	memset(f, 0, sizeof(*f));
+	f->planes = format->planes;
+
+	mode = fthd_v4l2_pick_mode(dev_priv, pix->width, pix->height);
+	if (mode) {
+		f->config = mode->config;
+		win_w = mode->width;
+		win_h = mode->height;
+	} else {
+		win_w = max_w;
+		win_h = max_h;
+	}
+
+	f->win_w = win_w;
+	f->win_h = win_h;
+	fthd_v4l2_default_crop(f, pix->width, pix->height);
 
 	switch (pix->pixelformat) {
-/*
-	case V4L2_PIX_FMT_NV16:
-		pix->sizeimage = pix->width * pix->height;
-		pix->bytesperline = pix->width;
+	case V4L2_PIX_FMT_NV16M:
+		/* Full height Y plane, half width interleaved CbCr plane */
+		f->plane_bpl[0] = pix->width;
+		f->plane_bpl[1] = pix->width;
 		break;
-*/
 	case V4L2_PIX_FMT_YUYV:
 	case V4L2_PIX_FMT_YVYU:
 	default:
-		pix->bytesperline = pix->width * 2;
-		pix->sizeimage = pix->bytesperline * pix->height;
+		f->plane_bpl[0] = pix->width * 2;
 		break;
 	}
 
+	pix->sizeimage = 0;
+	for (i = 0; i < f->planes; i++) {
+		f->plane_size[i] = f->plane_bpl[i] * pix->height;
+		pix->sizeimage += f->plane_size[i];
+	}
+	pix->bytesperline = f->plane_bpl[0];
+
+	f->fmt = *pix;
 	return 0;
 }
 
@@ -452,13 +868,14 @@ static int fthd_v4l2_ioctl_try_fmt_vid_cap(struct file *filp, void *_priv,
 					   struct v4l2_format *fmt)
 {
 	struct fthd_private *dev_priv = video_drvdata(filp);
+	struct fthd_fmt f;
 
 	pr_debug("%s: %dx%d\n", __FUNCTION__, fmt->fmt.pix.width, fmt->fmt.pix.height);
 
-	if (fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+	if (fmt->type != dev_priv->vb2_queue.type)
 		return -EINVAL;
 
-	return fthd_v4l2_adjust_format(dev_priv, &fmt->fmt.pix);
+	return fthd_v4l2_adjust_format(dev_priv, &fmt->fmt.pix, &f);
 }
 
 static int fthd_v4l2_ioctl_g_fmt_vid_cap(struct file *filp, void *priv,
@@ -467,42 +884,129 @@ static int fthd_v4l2_ioctl_g_fmt_vid_cap(struct file *filp, void *priv,
 	struct fthd_private *dev_priv = video_drvdata(filp);
 
 	pr_debug("%s\n", __FUNCTION__);
-	fmt->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (fmt->type != dev_priv->vb2_queue.type)
+		return -EINVAL;
+
 	fmt->fmt.pix = dev_priv->fmt.fmt;
 
 	return 0;
 }
 
+static int fthd_v4l2_set_format(struct fthd_private *dev_priv,
+				struct v4l2_pix_format *pix)
+{
+	struct fthd_fmt f;
+	int ret;
+
+	/* REQBUFS and S_SELECTION look at the format under the queue lock */
+	if (mutex_lock_interruptible(&dev_priv->vb2_queue_lock))
+		return -ERESTARTSYS;
+
+	if (vb2_is_busy(&dev_priv->vb2_queue)) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	ret = fthd_v4l2_adjust_format(dev_priv, pix, &f);
+	if (ret)
+		goto out;
+
+	pr_debug("%c%c%c%c\n", pix->pixelformat, pix->pixelformat >> 8,
+		 pix->pixelformat >> 16, pix->pixelformat >> 24);
+
+	dev_priv->fmt = f;
+out:
+	mutex_unlock(&dev_priv->vb2_queue_lock);
+	return ret;
+}
+
 static int fthd_v4l2_ioctl_s_fmt_vid_cap(struct file *filp, void *priv,
 					 struct v4l2_format *fmt)
 {
 	struct fthd_private *dev_priv = video_drvdata(filp);
-	int ret;
 
-	if (fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+	if (fmt->type != dev_priv->vb2_queue.type)
 		return -EINVAL;
 
-	/* FIXME: Check if hardware is busy */
+	return fthd_v4l2_set_format(dev_priv, &fmt->fmt.pix);
+}
 
-	ret = fthd_v4l2_adjust_format(dev_priv, &fmt->fmt.pix);
+static void fthd_v4l2_fill_mplane(const struct fthd_fmt *f,
+				  struct v4l2_pix_format_mplane *mp)
+{
+	int i;
+
+	memset(mp, 0, sizeof(*mp));
+	mp->width = f->fmt.width;
+	mp->height = f->fmt.height;
+	mp->pixelformat = f->fmt.pixelformat;
+	mp->field = f->fmt.field;
+	mp->colorspace = f->fmt.colorspace;
+	mp->num_planes = f->planes;
+
+	for (i = 0; i < f->planes; i++) {
+		mp->plane_fmt[i].bytesperline = f->plane_bpl[i];
+		mp->plane_fmt[i].sizeimage = f->plane_size[i];
+	}
+}
+
+static void fthd_v4l2_from_mplane(const struct v4l2_pix_format_mplane *mp,
+				  struct v4l2_pix_format *pix)
+{
+	memset(pix, 0, sizeof(*pix));
+	pix->width = mp->width;
+	pix->height = mp->height;
+	pix->pixelformat = mp->pixelformat;
+}
+
+static int fthd_v4l2_ioctl_try_fmt_vid_cap_mplane(struct file *filp, void *priv,
+						  struct v4l2_format *fmt)
+{
+	struct fthd_private *dev_priv = video_drvdata(filp);
+	struct v4l2_pix_format pix;
+	struct fthd_fmt f;
+	int ret;
+
+	if (fmt->type != dev_priv->vb2_queue.type)
+		return -EINVAL;
+
+	fthd_v4l2_from_mplane(&fmt->fmt.pix_mp, &pix);
+	ret = fthd_v4l2_adjust_format(dev_priv, &pix, &f);
 	if (ret)
 		return ret;
 
-	pr_debug("%c%c%c%c\n", fmt->fmt.pix.pixelformat, fmt->fmt.pix.pixelformat >> 8,
-		 fmt->fmt.pix.pixelformat >> 16, fmt->fmt.pix.pixelformat >> 24);
+	fthd_v4l2_fill_mplane(&f, &fmt->fmt.pix_mp);
+	return 0;
+}
 
-	dev_priv->fmt.fmt = fmt->fmt.pix;
+static int fthd_v4l2_ioctl_g_fmt_vid_cap_mplane(struct file *filp, void *priv,
+						struct v4l2_format *fmt)
+{
+	struct fthd_private *dev_priv = video_drvdata(filp);
 
-	switch (fmt->fmt.pix.pixelformat) {
-	case V4L2_PIX_FMT_NV16:
-		dev_priv->fmt.planes = 2;
-		break;
-	case V4L2_PIX_FMT_YUYV:
-	case V4L2_PIX_FMT_YVYU:
-		dev_priv->fmt.planes = 1;
-		break;
-	}
+	if (fmt->type != dev_priv->vb2_queue.type)
+		return -EINVAL;
 
+	fthd_v4l2_fill_mplane(&dev_priv->fmt, &fmt->fmt.pix_mp);
+	return 0;
+}
+
+static int fthd_v4l2_ioctl_s_fmt_vid_cap_mplane(struct file *filp, void *priv,
+						struct v4l2_format *fmt)
+{
+	struct fthd_private *dev_priv = video_drvdata(filp);
+	struct v4l2_pix_format pix;
+	int ret;
+
+	if (fmt->type != dev_priv->vb2_queue.type)
+		return -EINVAL;
+
+	fthd_v4l2_from_mplane(&fmt->fmt.pix_mp, &pix);
+	ret = fthd_v4l2_set_format(dev_priv, &pix);
+	if (ret)
+		return ret;
+
+	fthd_v4l2_fill_mplane(&dev_priv->fmt, &fmt->fmt.pix_mp);
 	return 0;
 }
 
@@ -510,17 +1014,18 @@ static int fthd_v4l2_ioctl_s_fmt_vid_cap(struct file *filp, void *priv,
 static int fthd_v4l2_ioctl_g_parm(struct file *filp, void *priv,
 		struct v4l2_streamparm *parm)
 {
-	/* Report a consistent 30 fps, matching what the sensor actually delivers
-	 * and what enum_frameintervals advertises. The old frametime/1000 value
-	 * (25 fps) disagreed with the real 30 fps rate, which made GStreamer's
-	 * pipewiresrc compute negative frame durations and stall after one frame
-	 * (e.g. GNOME Snapshot froze, while ffplay/v4l2-ctl were unaffected). */
+	/* Report the rate the sensor is programmed for, which is always one
+	 * of the intervals enum_frameintervals advertises. Reporting anything
+	 * else (the old code claimed 25 fps while the sensor ran at 30) made
+	 * GStreamer's pipewiresrc compute negative frame durations and stall
+	 * after one frame. The measured rate is in debugfs. */
+	struct fthd_private *dev_priv = video_drvdata(filp);
 	struct v4l2_fract timeperframe = {
 		.numerator = 1,
-		.denominator = 30,
+		.denominator = dev_priv->fps,
 	};
 
-	if (parm->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+	if (parm->type != dev_priv->vb2_queue.type)
 		return -EINVAL;
 
 	parm->parm.capture.readbuffers = FTHD_BUFFERS;
@@ -535,19 +1040,58 @@ static int fthd_v4l2_ioctl_s_parm(struct file *filp, void *priv,
 
         struct fthd_private *dev_priv = video_drvdata(filp);
 	struct v4l2_fract *timeperframe;
+	unsigned int fps;
+	int ret;
 
-	if (parm->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+	if (parm->type != dev_priv->vb2_queue.type)
 		return -EINVAL;
 
 	timeperframe = &parm->parm.capture.timeperframe;
 
-	if(timeperframe->denominator == 0) {
-		timeperframe->numerator = 20;
-		timeperframe->denominator = 1000;
+	/* Keeps streamon/streamoff and recovery from changing the queue
+	 * state between the checks below and the firmware command */
+	if (mutex_lock_interruptible(&dev_priv->vb2_queue_lock))
+		return -ERESTARTSYS;
+
+	/* A zero interval asks for the fastest rate */
+	if (!timeperframe->denominator)
+		fps = fthd_v4l2_snap_fps(0, 1);
+	else
+		fps = fthd_v4l2_snap_fps(timeperframe->numerator,
+					 timeperframe->denominator);
+
+	if (fps != dev_priv->fps) {
+		unsigned int old_fps = dev_priv->fps;
+
+		/* fthd_isp_set_frame_rate() programs dev_priv->fps */
+		dev_priv->fps = fps;
+		dev_priv->frametime = 1000 / fps;
+
+		if (vb2_is_streaming(&dev_priv->vb2_queue)) {
+			ret = fthd_isp_set_frame_rate(dev_priv, 0);
+			if (ret) {
+				/* The limits may be half applied, put the old
+				 * rate back */
+				dev_priv->fps = old_fps;
+				dev_priv->frametime = 1000 / old_fps;
+				fthd_isp_set_frame_rate(dev_priv, 0);
+				mutex_unlock(&dev_priv->vb2_queue_lock);
+				return ret;
+			}
+		} else if (!vb2_is_busy(&dev_priv->vb2_queue)) {
+			/* May call for another sensor mode. Only then is the
+			 * format redone, which resets the crop to the new
+			 * mode's window; otherwise an S_SELECTION crop stays. */
+			struct v4l2_pix_format pix = dev_priv->fmt.fmt;
+			struct fthd_fmt f;
+
+			if (!fthd_v4l2_adjust_format(dev_priv, &pix, &f) &&
+			    f.config != dev_priv->fmt.config)
+				dev_priv->fmt = f;
+		}
 	}
 
-	dev_priv->frametime = clamp_t(unsigned int, timeperframe->numerator * 1000 /
-				timeperframe->denominator, 20, 500);
+	mutex_unlock(&dev_priv->vb2_queue_lock);
 
 	return fthd_v4l2_ioctl_g_parm(filp, priv, parm);
 }
@@ -560,13 +1104,19 @@ static int fthd_v4l2_ioctl_enum_framesizes(struct file *filp, void *priv,
 	if (sizes->index)
 		return -EINVAL;
 
-	if (sizes->pixel_format != V4L2_PIX_FMT_YUYV &&
-	    sizes->pixel_format != V4L2_PIX_FMT_YVYU)
+	if (!fthd_v4l2_find_format(dev_priv, sizes->pixel_format))
 		return -EINVAL;
 
-	sizes->type = V4L2_FRMSIZE_TYPE_DISCRETE;
-	sizes->discrete.width  = dev_priv->sensor_width  ? : FTHD_MAX_WIDTH;
-	sizes->discrete.height = dev_priv->sensor_height ? : FTHD_MAX_HEIGHT;
+	/* Anything between the minimum and the sensor size is scaled by the ISP */
+	sizes->type = V4L2_FRMSIZE_TYPE_STEPWISE;
+	sizes->stepwise.min_width = FTHD_MIN_WIDTH;
+	sizes->stepwise.min_height = FTHD_MIN_HEIGHT;
+	sizes->stepwise.max_width = round_down(dev_priv->sensor_width ? : FTHD_MAX_WIDTH,
+					       FTHD_STEP_WIDTH);
+	sizes->stepwise.max_height = round_down(dev_priv->sensor_height ? : FTHD_MAX_HEIGHT,
+						FTHD_STEP_HEIGHT);
+	sizes->stepwise.step_width = FTHD_STEP_WIDTH;
+	sizes->stepwise.step_height = FTHD_STEP_HEIGHT;
 
 	return 0;
 }
@@ -580,32 +1130,165 @@ static int fthd_v4l2_ioctl_enum_frameintervals(struct file *filp, void *priv,
 
 	pr_debug("%s\n", __FUNCTION__);
 
-	if (interval->index)
+	if (!fthd_v4l2_find_format(dev_priv, interval->pixel_format))
 		return -EINVAL;
 
-	if (interval->pixel_format != V4L2_PIX_FMT_YUYV &&
-	    interval->pixel_format != V4L2_PIX_FMT_YVYU &&
-	    interval->pixel_format != V4L2_PIX_FMT_NV16)
-		return -EINVAL;
-
-	if (interval->width & 7
+	if (interval->width % FTHD_STEP_WIDTH
+	    || interval->height % FTHD_STEP_HEIGHT
+	    || interval->width < FTHD_MIN_WIDTH
+	    || interval->height < FTHD_MIN_HEIGHT
 	    || interval->width > max_w
 	    || interval->height > max_h)
 		return -EINVAL;
 
+	/* Same rates at every size, see fthd_v4l2_pick_mode() */
+	if (interval->index >= ARRAY_SIZE(fthd_frame_rates))
+		return -EINVAL;
+
 	interval->type = V4L2_FRMIVAL_TYPE_DISCRETE;
 	interval->discrete.numerator = 1;
-	interval->discrete.denominator = 30;
+	interval->discrete.denominator = fthd_frame_rates[interval->index];
+	return 0;
+}
+
+/*
+ * Crop selects the sensor window that is scaled to the format size; it is
+ * reset by S_FMT. Compose is always the whole buffer.
+ */
+static int fthd_v4l2_ioctl_g_selection(struct file *filp, void *priv,
+				       struct v4l2_selection *sel)
+{
+	struct fthd_private *dev_priv = video_drvdata(filp);
+	struct fthd_fmt f = dev_priv->fmt;
+
+	if (sel->type != V4L2_BUF_TYPE_VIDEO_CAPTURE &&
+	    sel->type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+		return -EINVAL;
+
+	if (sel->target == V4L2_SEL_TGT_CROP_DEFAULT)
+		fthd_v4l2_default_crop(&f, f.fmt.width, f.fmt.height);
+
+	switch (sel->target) {
+	case V4L2_SEL_TGT_CROP_DEFAULT:
+	case V4L2_SEL_TGT_CROP:
+		sel->r.left = f.x1;
+		sel->r.top = f.y1;
+		sel->r.width = f.x2;
+		sel->r.height = f.y2;
+		break;
+	case V4L2_SEL_TGT_CROP_BOUNDS:
+		sel->r.left = 0;
+		sel->r.top = 0;
+		sel->r.width = f.win_w;
+		sel->r.height = f.win_h;
+		break;
+	case V4L2_SEL_TGT_COMPOSE:
+	case V4L2_SEL_TGT_COMPOSE_DEFAULT:
+	case V4L2_SEL_TGT_COMPOSE_BOUNDS:
+		sel->r.left = 0;
+		sel->r.top = 0;
+		sel->r.width = f.fmt.width;
+		sel->r.height = f.fmt.height;
+		break;
+	default:
+		return -EINVAL;
+	}
 
 	return 0;
 }
 
+/*
+ * Round a crop size to the 2 pixel step within [min, max], in the
+ * direction V4L2_SEL_FLAG_GE/LE ask for. -ERANGE if the flags can't be met.
+ */
+static int fthd_v4l2_crop_size(unsigned int req, unsigned int min,
+			       unsigned int max, u32 flags, unsigned int *size)
+{
+	unsigned int val = clamp(req, min, max);
+
+	if ((flags & V4L2_SEL_FLAG_GE) && !(flags & V4L2_SEL_FLAG_LE))
+		val = round_up(val, 2);
+	else
+		val = round_down(val, 2);
+	if (val > max)
+		val = round_down(max, 2);
+
+	if ((flags & V4L2_SEL_FLAG_GE) && val < req)
+		return -ERANGE;
+	if ((flags & V4L2_SEL_FLAG_LE) && val > req)
+		return -ERANGE;
+
+	*size = val;
+	return 0;
+}
+
+static int fthd_v4l2_ioctl_s_selection(struct file *filp, void *priv,
+				       struct v4l2_selection *sel)
+{
+	struct fthd_private *dev_priv = video_drvdata(filp);
+	struct fthd_fmt *f = &dev_priv->fmt;
+	unsigned int min_w, min_h, w, h;
+	int x, y, ret;
+
+	if (sel->type != V4L2_BUF_TYPE_VIDEO_CAPTURE &&
+	    sel->type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+		return -EINVAL;
+
+	if (sel->target == V4L2_SEL_TGT_COMPOSE)
+		return fthd_v4l2_ioctl_g_selection(filp, priv, sel);
+	if (sel->target != V4L2_SEL_TGT_CROP)
+		return -EINVAL;
+
+	/* Keeps S_FMT, streamon/streamoff and recovery away from the format
+	 * and the live crop */
+	if (mutex_lock_interruptible(&dev_priv->vb2_queue_lock))
+		return -ERESTARTSYS;
+
+	/* Upscaling is limited to FTHD_MAX_ZOOM */
+	min_w = max_t(unsigned int, FTHD_MIN_WIDTH,
+		      DIV_ROUND_UP(f->fmt.width, FTHD_MAX_ZOOM));
+	min_h = max_t(unsigned int, FTHD_MIN_HEIGHT,
+		      DIV_ROUND_UP(f->fmt.height, FTHD_MAX_ZOOM));
+	min_w = min(round_up(min_w, 2), f->win_w);
+	min_h = min(round_up(min_h, 2), f->win_h);
+
+	ret = fthd_v4l2_crop_size(sel->r.width, min_w, f->win_w, sel->flags, &w);
+	if (ret)
+		goto out;
+	ret = fthd_v4l2_crop_size(sel->r.height, min_h, f->win_h, sel->flags, &h);
+	if (ret)
+		goto out;
+	x = round_down(clamp_t(int, sel->r.left, 0, f->win_w - w), 2);
+	y = round_down(clamp_t(int, sel->r.top, 0, f->win_h - h), 2);
+
+	if (vb2_is_streaming(&dev_priv->vb2_queue)) {
+		ret = fthd_isp_cmd_channel_crop_set(dev_priv, 0, x, y, w, h);
+		if (ret)
+			goto out;
+	}
+
+	f->x1 = x;
+	f->y1 = y;
+	f->x2 = w;
+	f->y2 = h;
+
+	sel->r.left = x;
+	sel->r.top = y;
+	sel->r.width = w;
+	sel->r.height = h;
+out:
+	mutex_unlock(&dev_priv->vb2_queue_lock);
+	return ret;
+}
+
 static int fthd_v4l2_ioctl_subscribe_event(struct v4l2_fh *fh,
 		const struct v4l2_event_subscription *sub)
 {
 	switch (sub->type) {
 	case V4L2_EVENT_CTRL:
 		return v4l2_ctrl_subscribe_event(fh, sub);
+	case V4L2_EVENT_MOTION_DET:
+		return v4l2_event_subscribe(fh, sub, 2, NULL);
 	}
 
 	return -EINVAL;
@@ -620,6 +1303,12 @@ static struct v4l2_ioctl_ops fthd_ioctl_ops = {
 
 	.vidioc_g_fmt_vid_cap   = fthd_v4l2_ioctl_g_fmt_vid_cap,
 	.vidioc_s_fmt_vid_cap   = fthd_v4l2_ioctl_s_fmt_vid_cap,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,3,0)
+	.vidioc_enum_fmt_vid_cap_mplane = fthd_v4l2_ioctl_enum_fmt_vid_cap,
+#endif
+	.vidioc_try_fmt_vid_cap_mplane = fthd_v4l2_ioctl_try_fmt_vid_cap_mplane,
+	.vidioc_g_fmt_vid_cap_mplane = fthd_v4l2_ioctl_g_fmt_vid_cap_mplane,
+	.vidioc_s_fmt_vid_cap_mplane = fthd_v4l2_ioctl_s_fmt_vid_cap_mplane,
 	.vidioc_querycap        = fthd_v4l2_ioctl_querycap,
 
 
@@ -636,6 +1325,8 @@ static struct v4l2_ioctl_ops fthd_ioctl_ops = {
 	.vidioc_s_parm          = fthd_v4l2_ioctl_s_parm,
 	.vidioc_enum_framesizes = fthd_v4l2_ioctl_enum_framesizes,
 	.vidioc_enum_frameintervals = fthd_v4l2_ioctl_enum_frameintervals,
+	.vidioc_g_selection     = fthd_v4l2_ioctl_g_selection,
+	.vidioc_s_selection     = fthd_v4l2_ioctl_s_selection,
 
 	.vidioc_subscribe_event	= fthd_v4l2_ioctl_subscribe_event,
 	.vidioc_unsubscribe_event = v4l2_event_unsubscribe,
@@ -669,6 +1360,42 @@ static int fthd_s_ctrl(struct v4l2_ctrl *ctrl)
 		break;
 	case V4L2_CID_AUTO_WHITE_BALANCE:
 		ret = fthd_isp_cmd_channel_awb(dev_priv, 0, ctrl->val);
+		break;
+	case V4L2_CID_EXPOSURE_AUTO_PRIORITY:
+		dev_priv->variable_fps = ctrl->val;
+		ret = 0;
+		/* Otherwise programmed by fthd_start_channel() */
+		if (dev_priv->channel_started)
+			ret = fthd_isp_set_frame_rate(dev_priv, 0);
+		break;
+	case FTHD_CID_MIN_FRAME_RATE:
+		dev_priv->min_fps = ctrl->val;
+		ret = 0;
+		if (dev_priv->channel_started)
+			ret = fthd_isp_set_frame_rate(dev_priv, 0);
+		break;
+	case FTHD_CID_FACE_DETECTION:
+		ret = 0;
+		if (dev_priv->channel_started &&
+		    ctrl->val != dev_priv->face_detection)
+			ret = fthd_isp_face_detection(dev_priv, 0, ctrl->val);
+		if (!ret)
+			dev_priv->face_detection = ctrl->val;
+		break;
+	case V4L2_CID_DETECT_MD_MODE:
+		dev_priv->md_mode = ctrl->val;
+		ret = 0;
+		break;
+	case V4L2_CID_DETECT_MD_GLOBAL_THRESHOLD:
+		dev_priv->md_threshold = ctrl->val;
+		ret = 0;
+		break;
+	case FTHD_CID_FACE_DETECTION_MAX:
+		dev_priv->face_detection_max = ctrl->val;
+		ret = 0;
+		if (dev_priv->channel_started && dev_priv->face_detection)
+			ret = fthd_isp_cmd_channel_face_detection_config(dev_priv, 0, ctrl->val);
+		break;
 
 	default:
 		break;
@@ -683,9 +1410,43 @@ static const struct v4l2_ctrl_ops fthd_ctrl_ops = {
 	.s_ctrl = fthd_s_ctrl,
 };
 
+static const struct v4l2_ctrl_config fthd_ctrl_min_frame_rate = {
+	.ops = &fthd_ctrl_ops,
+	.id = FTHD_CID_MIN_FRAME_RATE,
+	.name = "Minimum Frame Rate",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = 1,
+	.max = 60,
+	.step = 1,
+	.def = FTHD_MIN_FPS,
+};
+
+static const struct v4l2_ctrl_config fthd_ctrl_face_detection = {
+	.ops = &fthd_ctrl_ops,
+	.id = FTHD_CID_FACE_DETECTION,
+	.name = "Face Detection",
+	.type = V4L2_CTRL_TYPE_BOOLEAN,
+	.min = 0,
+	.max = 1,
+	.step = 1,
+	.def = 1,
+};
+
+static const struct v4l2_ctrl_config fthd_ctrl_face_detection_max = {
+	.ops = &fthd_ctrl_ops,
+	.id = FTHD_CID_FACE_DETECTION_MAX,
+	.name = "Face Detection Max Faces",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = 1,
+	.max = FTHD_ISP_MAX_FACES,
+	.step = 1,
+	.def = FTHD_ISP_MAX_FACES,
+};
+
 int fthd_v4l2_register(struct fthd_private *dev_priv)
 {
 	struct v4l2_device *v4l2_dev = &dev_priv->v4l2_dev;
+	struct v4l2_pix_format pix;
 	struct video_device *vdev;
 	struct vb2_queue *q;
 	int ret;
@@ -704,8 +1465,14 @@ int fthd_v4l2_register(struct fthd_private *dev_priv)
 	dev_priv->videodev = vdev;
 
 	q = &dev_priv->vb2_queue;
-	q->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	q->io_modes = VB2_MMAP | VB2_USERPTR | VB2_DMABUF | VB2_READ;
+	if (dev_priv->multiplanar) {
+		/* read() can't return more than one plane */
+		q->type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+		q->io_modes = VB2_MMAP | VB2_USERPTR | VB2_DMABUF;
+	} else {
+		q->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		q->io_modes = VB2_MMAP | VB2_USERPTR | VB2_DMABUF | VB2_READ;
+	}
 	q->drv_priv = dev_priv;
 	q->ops = &vb2_queue_ops;
 	q->mem_ops = &vb2_dma_sg_memops;
@@ -722,7 +1489,7 @@ int fthd_v4l2_register(struct fthd_private *dev_priv)
 	if (ret)
 		goto fail;
 
-	v4l2_ctrl_handler_init(&dev_priv->v4l2_ctrl_handler, 4);
+	v4l2_ctrl_handler_init(&dev_priv->v4l2_ctrl_handler, 11);
 	v4l2_ctrl_new_std(&dev_priv->v4l2_ctrl_handler, &fthd_ctrl_ops,
 			  V4L2_CID_BRIGHTNESS, 0, 0xff, 1, 0x80);
 	v4l2_ctrl_new_std(&dev_priv->v4l2_ctrl_handler, &fthd_ctrl_ops,
@@ -733,6 +1500,24 @@ int fthd_v4l2_register(struct fthd_private *dev_priv)
 			  V4L2_CID_HUE, 0, 0xff, 1, 0x80);
 	v4l2_ctrl_new_std(&dev_priv->v4l2_ctrl_handler, &fthd_ctrl_ops,
 			  V4L2_CID_AUTO_WHITE_BALANCE, 0, 1, 1, 1);
+	/* Off: constant frame rate. On: AE may lower it for exposure */
+	v4l2_ctrl_new_std(&dev_priv->v4l2_ctrl_handler, &fthd_ctrl_ops,
+			  V4L2_CID_EXPOSURE_AUTO_PRIORITY, 0, 1, 1, 0);
+	v4l2_ctrl_new_custom(&dev_priv->v4l2_ctrl_handler,
+			     &fthd_ctrl_min_frame_rate, NULL);
+	v4l2_ctrl_new_custom(&dev_priv->v4l2_ctrl_handler,
+			     &fthd_ctrl_face_detection, NULL);
+	v4l2_ctrl_new_custom(&dev_priv->v4l2_ctrl_handler,
+			     &fthd_ctrl_face_detection_max, NULL);
+	/* Threshold is the number of grid cells that changed */
+	v4l2_ctrl_new_std_menu(&dev_priv->v4l2_ctrl_handler, &fthd_ctrl_ops,
+			       V4L2_CID_DETECT_MD_MODE, V4L2_DETECT_MD_MODE_GLOBAL,
+			       ~((1 << V4L2_DETECT_MD_MODE_DISABLED) |
+				 (1 << V4L2_DETECT_MD_MODE_GLOBAL)),
+			       V4L2_DETECT_MD_MODE_DISABLED);
+	v4l2_ctrl_new_std(&dev_priv->v4l2_ctrl_handler, &fthd_ctrl_ops,
+			  V4L2_CID_DETECT_MD_GLOBAL_THRESHOLD, 1, FTHD_LUMA_CELLS, 1,
+			  FTHD_MOTION_THRESHOLD);
 
 	if (dev_priv->v4l2_ctrl_handler.error) {
 		pr_err("failed to setup control handlers\n");
@@ -751,8 +1536,12 @@ int fthd_v4l2_register(struct fthd_private *dev_priv)
 	vdev->release = video_device_release;
 	vdev->ctrl_handler = &dev_priv->v4l2_ctrl_handler;
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5,4,0)
-	vdev->device_caps = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_READWRITE |
-			    V4L2_CAP_STREAMING;
+	if (dev_priv->multiplanar)
+		vdev->device_caps = V4L2_CAP_VIDEO_CAPTURE_MPLANE |
+				    V4L2_CAP_STREAMING;
+	else
+		vdev->device_caps = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_READWRITE |
+				    V4L2_CAP_STREAMING;
 #endif
 	video_set_drvdata(vdev, dev_priv);
 	ret = video_register_device(vdev, VFL_TYPE_VIDEO, -1);
@@ -762,13 +1551,18 @@ int fthd_v4l2_register(struct fthd_private *dev_priv)
 	}
 	/* Default to the sensor's native resolution (detected at probe), or the
 	 * generic ceiling if detection didn't run. */
-	dev_priv->fmt.fmt.width  = dev_priv->sensor_width  ? : FTHD_MAX_WIDTH;
-	dev_priv->fmt.fmt.height = dev_priv->sensor_height ? : FTHD_MAX_HEIGHT;
-	dev_priv->fmt.fmt.pixelformat = V4L2_PIX_FMT_YUYV;
-	dev_priv->fmt.fmt.sizeimage = dev_priv->fmt.fmt.width * dev_priv->fmt.fmt.height * 2;
-	dev_priv->fmt.planes = 1;
+	memset(&pix, 0, sizeof(pix));
+	pix.width  = dev_priv->sensor_width  ? : FTHD_MAX_WIDTH;
+	pix.height = dev_priv->sensor_height ? : FTHD_MAX_HEIGHT;
+	pix.pixelformat = V4L2_PIX_FMT_YUYV;
 
-	fthd_v4l2_adjust_format(dev_priv, &dev_priv->fmt.fmt);
+	fthd_v4l2_adjust_format(dev_priv, &pix, &dev_priv->fmt);
+
+	/* The video node works without it */
+	ret = fthd_meta_register(dev_priv);
+	if (ret)
+		dev_warn(&dev_priv->pdev->dev,
+			 "failed to register metadata node: %d\n", ret);
 
 	return 0;
 fail_vdev:
@@ -16,19 +16,36 @@
 #include <linux/mutex.h>
 #include <media/v4l2-device.h>
 
+/* Lowest rate AE may drop to when V4L2_CID_EXPOSURE_AUTO_PRIORITY allows
+ * a variable frame rate */
+#define FTHD_CID_MIN_FRAME_RATE	(V4L2_CID_CAMERA_CLASS_BASE + 0x1000)
+/* Firmware face detection on/off and the most faces it reports */
+#define FTHD_CID_FACE_DETECTION	(V4L2_CID_CAMERA_CLASS_BASE + 0x1001)
+#define FTHD_CID_FACE_DETECTION_MAX (V4L2_CID_CAMERA_CLASS_BASE + 0x1002)
+
+/* The dma descriptor has room for three plane addresses */
+#define FTHD_MAX_PLANES 3
+
 struct fthd_fmt {
 	struct v4l2_pix_format fmt;
 	const char *desc;
 	int range; /* CISP_COMMAND_CH_OUTPUT_CONFIG_SET */
 	int planes;
-	int x1; /* for CISP_CMD_CH_CROP_SET */
-	int y1;
+	int config; /* CISP_CMD_CH_CAMERA_CONFIG_SELECT */
+	unsigned int plane_bpl[FTHD_MAX_PLANES];
+	unsigned int plane_size[FTHD_MAX_PLANES];
+	int x1; /* for CISP_CMD_CH_CROP_SET: origin and size of the */
+	int y1; /* sensor window scaled to fmt.width x fmt.height */
 	int x2;
 	int y2;
+	unsigned int win_w; /* size of the sensor mode the crop lies in */
+	unsigned int win_h;
 };
 
 struct fthd_private;
 extern int fthd_v4l2_register(struct fthd_private *dev_priv);
 extern void fthd_v4l2_unregister(struct fthd_private *dev_priv);
+extern void fthd_v4l2_recovery_prepare(struct fthd_private *dev_priv);
+extern int fthd_v4l2_recovery_finish(struct fthd_private *dev_priv);
 
 #endif